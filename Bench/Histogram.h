@@ -0,0 +1,121 @@
+
+#ifndef THORSANVIL_BENCH_HISTOGRAM_H
+#define THORSANVIL_BENCH_HISTOGRAM_H
+
+#include <vector>
+#include <limits>
+#include <algorithm>
+#include <cstdint>
+#include <cstddef>
+
+namespace ThorsAnvil
+{
+    namespace Bench
+    {
+
+/*
+ * A log-linear (HDR style) histogram of 64 bit values.
+ *
+ * Values below 2^subBits are counted exactly. Above that each power of
+ * two range is split into 2^(subBits-1) equal buckets. So every value is
+ * recorded with a relative error below 2^-(subBits-1) (under 1.6% for the
+ * default) using a fixed 3.7K buckets regardless of the range of values.
+ *
+ * Recording is a couple of shifts and an increment so it can be done on
+ * every request. Each thread keeps its own histogram and they are merged
+ * at the end.
+ */
+class Histogram
+{
+    static constexpr unsigned       subBits     = 7;
+    static constexpr std::uint64_t  subCount    = std::uint64_t{1} << subBits;
+    static constexpr std::uint64_t  halfCount   = subCount / 2;
+    static constexpr std::size_t    bucketCount = subCount + (64 - subBits) * halfCount;
+
+    std::vector<std::uint64_t>  counts;
+    std::uint64_t               total;
+    std::uint64_t               minValue;
+    std::uint64_t               maxValue;
+    double                      sum;
+
+    static std::size_t index(std::uint64_t value)
+    {
+        if (value < subCount)
+        {
+            return value;
+        }
+        // Keep the top subBits bits of the value.
+        unsigned    msb     = 63 - __builtin_clzll(value);
+        unsigned    shift   = msb - subBits + 1;
+        return subCount + (shift - 1) * halfCount + ((value >> shift) - halfCount);
+    }
+    // The largest value that is recorded in bucket `index`.
+    static std::uint64_t highestValue(std::size_t index)
+    {
+        if (index < subCount)
+        {
+            return index;
+        }
+        unsigned        shift   = (index - subCount) / halfCount + 1;
+        std::uint64_t   top     = (index - subCount) % halfCount + halfCount;
+        return ((top + 1) << shift) - 1;
+    }
+    public:
+        Histogram()
+            : counts(bucketCount, 0)
+            , total(0)
+            , minValue(std::numeric_limits<std::uint64_t>::max())
+            , maxValue(0)
+            , sum(0)
+        {}
+
+        void record(std::uint64_t value)
+        {
+            ++counts[index(value)];
+            ++total;
+            minValue    = std::min(minValue, value);
+            maxValue    = std::max(maxValue, value);
+            sum         += value;
+        }
+        void merge(Histogram const& other)
+        {
+            for(std::size_t loop = 0; loop < bucketCount; ++loop)
+            {
+                counts[loop] += other.counts[loop];
+            }
+            total       += other.total;
+            minValue    = std::min(minValue, other.minValue);
+            maxValue    = std::max(maxValue, other.maxValue);
+            sum         += other.sum;
+        }
+
+        std::uint64_t   count() const   {return total;}
+        std::uint64_t   min() const     {return total == 0 ? 0 : minValue;}
+        std::uint64_t   max() const     {return maxValue;}
+        double          mean() const    {return total == 0 ? 0 : sum / total;}
+
+        // The value below which `percent` of the recorded values fall.
+        std::uint64_t percentile(double percent) const
+        {
+            if (total == 0)
+            {
+                return 0;
+            }
+            std::uint64_t   wanted  = std::max<std::uint64_t>(1, static_cast<std::uint64_t>(percent / 100 * total + 0.5));
+            std::uint64_t   seen    = 0;
+            for(std::size_t loop = 0; loop < bucketCount; ++loop)
+            {
+                seen += counts[loop];
+                if (seen >= wanted)
+                {
+                    return std::min(highestValue(loop), maxValue);
+                }
+            }
+            return maxValue;
+        }
+};
+
+    }
+}
+
+#endif
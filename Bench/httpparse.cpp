@@ -0,0 +1,334 @@
+
+#include "Socket.h"
+#include "ProtocolHTTP.h"
+#include <atomic>
+#include <chrono>
+#include <random>
+#include <string>
+#include <vector>
+#include <new>
+#include <cstdlib>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <sys/socket.h>
+#include <sys/uio.h>
+
+/*
+ * ProtocolHTTP parser benchmark.
+ *
+ * Replays a corpus of request and response byte streams through
+ * HTTPServer/HTTPClient recvMessage() with no network involved: an
+ * in-memory SocketIO hands the stream to the protocol in the same pieces
+ * a socket would (one piece per read()). So the cost measured is only
+ * the parser (start line, headers, body framing and buffer management).
+ *
+ * Each stream is one kept-alive connection carrying many messages:
+ *      small-get       Minimal GET requests, one per read.
+ *      large-headers   Browser style requests (~2.5K of headers), one per read.
+ *      post-body       POST with a 1K Content-Length body.
+ *      chunked         POST with a chunked body (several chunks).
+ *      pipelined       Small GETs delivered 16 to a read.
+ *      fragmented      The large-headers stream split at random points (1-100 bytes).
+ *      responses       Responses (Content-Length and chunked) parsed by HTTPClient.
+ *
+ * Reports ns/message, MB/s of input parsed and heap allocations per message
+ * (counted by replacing the global operator new).
+ *
+ *      ./httpparse [<rounds>]
+ */
+
+namespace Sock = ThorsAnvil::Socket;
+
+static std::atomic<std::size_t> allocations(0);
+
+void* operator new(std::size_t size)
+{
+    ++allocations;
+    if (void* result = std::malloc(size == 0 ? 1 : size))
+    {
+        return result;
+    }
+    throw std::bad_alloc();
+}
+void operator delete(void* data) noexcept
+{
+    std::free(data);
+}
+void operator delete(void* data, std::size_t) noexcept
+{
+    std::free(data);
+}
+
+// Serves a fixed stream of bytes split into the given pieces.
+// Writes (there are none when only receiving) are discarded.
+class MemorySocketIO: public Sock::SocketIO
+{
+    std::string const&              stream;
+    std::vector<std::size_t> const& pieces;
+    std::size_t                     piece;
+    std::size_t                     offset;
+    std::size_t                     pieceLeft;
+    public:
+        MemorySocketIO(std::string const& stream, std::vector<std::size_t> const& pieces)
+            : stream(stream)
+            , pieces(pieces)
+            , piece(0)
+            , offset(0)
+            , pieceLeft(pieces.empty() ? 0 : pieces[0])
+        {}
+        virtual ssize_t read(int, char* buffer, std::size_t size) override
+        {
+            if (pieceLeft == 0)
+            {
+                if (piece + 1 >= pieces.size())
+                {
+                    // End of the stream: the other end closed the connection.
+                    return 0;
+                }
+                pieceLeft = pieces[++piece];
+            }
+            std::size_t get = std::min(size, pieceLeft);
+            std::memcpy(buffer, stream.data() + offset, get);
+            offset      += get;
+            pieceLeft   -= get;
+            return get;
+        }
+        virtual ssize_t write(int, char const*, std::size_t size) override
+        {
+            return size;
+        }
+        virtual ssize_t writev(int, struct iovec const* data, int count, int) override
+        {
+            ssize_t size = 0;
+            for(int loop = 0; loop < count; ++loop)
+            {
+                size += data[loop].iov_len;
+            }
+            return size;
+        }
+        virtual int accept(int, int) override
+        {
+            errno = EINVAL;
+            return -1;
+        }
+        virtual ssize_t sendfile(int, int, off_t* offset, std::size_t size) override
+        {
+            *offset += size;
+            return size;
+        }
+};
+
+struct Corpus
+{
+    char const*                 name;
+    bool                        responses;
+    std::size_t                 messages;
+    std::string                 stream;
+    std::vector<std::size_t>    pieces;
+
+    // Add a message that arrives in a single read.
+    void add(std::string const& message)
+    {
+        stream += message;
+        pieces.emplace_back(message.size());
+        ++messages;
+    }
+};
+
+std::string smallGet(int id)
+{
+    return "GET /index.html?id=" + std::to_string(id) + " HTTP/1.1\r\n"
+           "Host: localhost\r\n"
+           "\r\n";
+}
+
+std::string largeHeaders(int id)
+{
+    return "GET /api/v1/projects/thors/builds?page=" + std::to_string(id) + "&sort=desc HTTP/1.1\r\n"
+           "Host: build.example.com:8080\r\n"
+           "User-Agent: Mozilla/5.0 (X11; Linux x86_64) AppleWebKit/537.36 (KHTML, like Gecko) Chrome/118.0.0.0 Safari/537.36\r\n"
+           "Accept: text/html,application/xhtml+xml,application/xml;q=0.9,image/avif,image/webp,*/*;q=0.8\r\n"
+           "Accept-Language: en-US,en;q=0.9,fr;q=0.8,de;q=0.7\r\n"
+           "Accept-Encoding: gzip, deflate, br\r\n"
+           "Referer: https://build.example.com/projects/thors/builds?page=" + std::to_string(id - 1) + "\r\n"
+           "Cookie: session=4f3c2b1a0e9d8c7b6a5f4e3d2c1b0a994f3c2b1a0e9d8c7b6a5f4e3d2c1b0a99; theme=dark; "
+                   "tracking=off; _ga=GA1.2.1234567890.1234567890; _gid=GA1.2.0987654321.0987654321; "
+                   "preferences=eyJsYW5ndWFnZSI6ImVuIiwidGltZXpvbmUiOiJVVEMiLCJwYWdlU2l6ZSI6NTB9; "
+                   "csrftoken=" + std::string(64, 'c') + "; sidebar=collapsed; recent=" + std::string(700, 'r') + "\r\n"
+           "Cache-Control: no-cache\r\n"
+           "Pragma: no-cache\r\n"
+           "DNT: 1\r\n"
+           "Upgrade-Insecure-Requests: 1\r\n"
+           "Sec-Fetch-Dest: document\r\n"
+           "Sec-Fetch-Mode: navigate\r\n"
+           "Sec-Fetch-Site: same-origin\r\n"
+           "Sec-Fetch-User: ?1\r\n"
+           "X-Request-Id: 7d9f1c2e-0b5a-4c3d-8e6f-" + std::to_string(100000000000 + id) + "\r\n"
+           "X-Forwarded-For: 203.0.113.17, 198.51.100.4\r\n"
+           "X-Forwarded-Proto: https\r\n"
+           "Authorization: Bearer " + std::string(600, 't') + "\r\n"
+           "\r\n";
+}
+
+std::string postBody(int id)
+{
+    std::string body(1024, 'a' + id % 26);
+    return "POST /api/v1/upload HTTP/1.1\r\n"
+           "Host: build.example.com:8080\r\n"
+           "Content-Type: application/octet-stream\r\n"
+           "Content-Length: " + std::to_string(body.size()) + "\r\n"
+           "\r\n" + body;
+}
+
+std::string chunked(int id)
+{
+    std::string message = "POST /api/v1/stream HTTP/1.1\r\n"
+                          "Host: build.example.com:8080\r\n"
+                          "Transfer-Encoding: chunked\r\n"
+                          "\r\n";
+    for(int chunk = 0; chunk < 4; ++chunk)
+    {
+        message += "100\r\n" + std::string(256, 'a' + (id + chunk) % 26) + "\r\n";
+    }
+    return message + "0\r\n\r\n";
+}
+
+std::string response(int id)
+{
+    if (id % 2 == 0)
+    {
+        std::string body(200, 'o');
+        return "HTTP/1.1 200 OK\r\n"
+               "Server: ThorsExperimental/0.1\r\n"
+               "Date: Sun, 18 Oct 2026 10:00:00 GMT\r\n"
+               "Content-Type: application/json\r\n"
+               "Content-Length: " + std::to_string(body.size()) + "\r\n"
+               "\r\n" + body;
+    }
+    return "HTTP/1.1 200 OK\r\n"
+           "Server: ThorsExperimental/0.1\r\n"
+           "Date: Sun, 18 Oct 2026 10:00:00 GMT\r\n"
+           "Content-Type: text/plain\r\n"
+           "Transfer-Encoding: chunked\r\n"
+           "\r\n"
+           "40\r\n" + std::string(64, 'x') + "\r\n"
+           "40\r\n" + std::string(64, 'y') + "\r\n"
+           "0\r\n\r\n";
+}
+
+std::vector<Corpus> buildCorpus()
+{
+    static constexpr int    count = 1000;
+    std::vector<Corpus>     corpus;
+
+    corpus.push_back({"small-get", false, 0, {}, {}});
+    corpus.push_back({"large-headers", false, 0, {}, {}});
+    corpus.push_back({"post-body", false, 0, {}, {}});
+    corpus.push_back({"chunked", false, 0, {}, {}});
+    corpus.push_back({"pipelined", false, 0, {}, {}});
+    corpus.push_back({"fragmented", false, 0, {}, {}});
+    corpus.push_back({"responses", true, 0, {}, {}});
+    for(int loop = 0; loop < count; ++loop)
+    {
+        corpus[0].add(smallGet(loop));
+        corpus[1].add(largeHeaders(loop));
+        corpus[2].add(postBody(loop));
+        corpus[3].add(chunked(loop));
+        corpus[6].add(response(loop));
+    }
+
+    // Pipelined: 16 requests per read.
+    Corpus& pipelined = corpus[4];
+    for(int loop = 0; loop < count; loop += 16)
+    {
+        std::string batch;
+        for(int message = loop; message < loop + 16 && message < count; ++message)
+        {
+            batch += smallGet(message);
+            ++pipelined.messages;
+        }
+        pipelined.stream += batch;
+        pipelined.pieces.emplace_back(batch.size());
+    }
+
+    // Fragmented: the same bytes as large-headers but split at random points.
+    Corpus& fragmented  = corpus[5];
+    fragmented.stream   = corpus[1].stream;
+    fragmented.messages = corpus[1].messages;
+    std::mt19937                                rng(42);
+    std::uniform_int_distribution<std::size_t>  split(1, 100);
+    for(std::size_t offset = 0; offset < fragmented.stream.size();)
+    {
+        std::size_t size = std::min(split(rng), fragmented.stream.size() - offset);
+        fragmented.pieces.emplace_back(size);
+        offset += size;
+    }
+    return corpus;
+}
+
+// Parse every message in the corpus once. Returns the number parsed.
+std::size_t replay(Corpus const& corpus, std::string& message)
+{
+    MemorySocketIO      io(corpus.stream, corpus.pieces);
+    // The descriptor is never used (all I/O goes to `io`).
+    Sock::DataSocket    socket(::socket(AF_UNIX, SOCK_STREAM, 0));
+    socket.setSocketIO(&io);
+
+    std::size_t         parsed = 0;
+    if (corpus.responses)
+    {
+        Sock::HTTPPost      client("localhost", socket);
+        for(; parsed < corpus.messages; ++parsed)
+        {
+            client.recvMessage(message);
+        }
+    }
+    else
+    {
+        Sock::HTTPServer    server(socket);
+        while(server.hasMessage())
+        {
+            server.recvMessage(message);
+            ++parsed;
+        }
+    }
+    return parsed;
+}
+
+int main(int argc, char* argv[])
+{
+    int                 rounds  = argc == 2 ? std::atoi(argv[1]) : 50;
+    std::vector<Corpus> corpus  = buildCorpus();
+    std::string         message;
+
+    std::cout << std::left << std::setw(16) << "Stream"
+              << std::right << std::setw(12) << "ns/Message"
+              << std::setw(12) << "MB/Sec"
+              << std::setw(14) << "Allocs/Msg" << "\n";
+    for(auto const& stream: corpus)
+    {
+        // Warm up (and check the whole stream parses).
+        if (replay(stream, message) != stream.messages)
+        {
+            std::cerr << stream.name << ": Parsed the wrong number of messages\n";
+            return 1;
+        }
+
+        using Clock = std::chrono::steady_clock;
+        std::size_t         startAllocations    = allocations;
+        Clock::time_point   start               = Clock::now();
+        for(int loop = 0; loop < rounds; ++loop)
+        {
+            replay(stream, message);
+        }
+        double              elapsed     = std::chrono::duration<double>(Clock::now() - start).count();
+        std::size_t         allocated   = allocations - startAllocations;
+        double              messages    = static_cast<double>(stream.messages) * rounds;
+
+        std::cout << std::left << std::setw(16) << stream.name << std::right << std::fixed
+                  << std::setw(12) << std::setprecision(1) << elapsed * 1e9 / messages
+                  << std::setw(12) << std::setprecision(1) << stream.stream.size() * rounds / elapsed / 1e6
+                  << std::setw(14) << std::setprecision(3) << allocated / messages << "\n";
+    }
+}
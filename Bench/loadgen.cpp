@@ -0,0 +1,257 @@
+
+#include "Socket.h"
+#include "ProtocolSimple.h"
+#include "ProtocolHTTP.h"
+#include "Histogram.h"
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <thread>
+#include <vector>
+#include <cstdlib>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <unistd.h>
+
+/*
+ * Load generator with latency percentiles (in the style of wrk2).
+ *
+ *      ./loadgen [-c <connections>] [-d <seconds>] [-r <requests/sec>]
+ *                [-p simple|http] [-k] [-s <payload bytes>] [-P <port>] [<host>]
+ *
+ *      -c  Number of concurrent connections (one thread each).     Default 8
+ *      -d  Length of the run in seconds.                           Default 5
+ *      -r  Total request rate. 0 (the default) sends the next request as
+ *          soon as the last one completes (closed loop).
+ *      -p  Protocol. "simple" (Version1/Version2 servers) or "http"
+ *          (Version3/Version4 servers).                            Default http
+ *      -k  Keep the connection open between requests (http only).
+ *      -s  Size of the request body.                               Default 4
+ *      -P  Server port.                                            Default 8080
+ *
+ * Coordinated omission:
+ *  A closed loop client stops sending while the server is stalled. So the
+ *  requests that would have seen the stall are never sent and the latency
+ *  percentiles look far better than a real user would see. With a rate (-r)
+ *  each request has a scheduled start time and its latency is measured
+ *  from that time (not from when it was actually sent). A stall then shows
+ *  up in every request that should have been sent during it.
+ *  The test still stops at the end of the run. Requests that were scheduled
+ *  but not yet sent (the client fell behind) are reported as "Unsent".
+ */
+
+namespace Sock  = ThorsAnvil::Socket;
+namespace Bench = ThorsAnvil::Bench;
+using Clock     = std::chrono::steady_clock;
+
+struct Options
+{
+    int             connections = 8;
+    int             seconds     = 5;
+    double          rate        = 0;
+    bool            http        = true;
+    bool            keepAlive   = false;
+    std::size_t     payload     = 4;
+    int             port        = 8080;
+    std::string     host        = "127.0.0.1";
+};
+
+struct Result
+{
+    Bench::Histogram    latency;
+    long                completed   = 0;
+    long                failed      = 0;
+    long                unsent      = 0;    // Scheduled before the end but not sent in time (-r only).
+};
+
+// One request on a new connection.
+void simpleRequest(Options const& options, std::string const& body)
+{
+    Sock::ConnectSocket    connect(options.host, options.port);
+    Sock::ProtocolSimple   simpleConnect(connect);
+    simpleConnect.sendMessage("", body);
+
+    std::string message;
+    simpleConnect.recvMessage(message);
+}
+
+// An HTTP connection that is reopened when the server (or the -k option) closes it.
+class HTTPConnection
+{
+    Options const&                      options;
+    std::unique_ptr<Sock::ConnectSocket>    socket;
+    std::unique_ptr<Sock::HTTPPost>         client;
+    public:
+        HTTPConnection(Options const& options)
+            : options(options)
+        {}
+        void request(std::string const& body)
+        {
+            if (!client || !client->keepAlive())
+            {
+                client.reset();
+                socket.reset(new Sock::ConnectSocket(options.host, options.port));
+                client.reset(new Sock::HTTPPost(options.host, *socket));
+                client->setKeepAlive(options.keepAlive);
+            }
+            try
+            {
+                client->sendMessage("/message", body);
+
+                std::string message;
+                client->recvMessage(message);
+            }
+            catch(...)
+            {
+                // Start again with a new connection.
+                client.reset();
+                throw;
+            }
+        }
+};
+
+void worker(Options const& options, Clock::time_point start, Clock::time_point end, Result& result)
+{
+    std::string         body(options.payload, 'x');
+    HTTPConnection      connection(options);
+
+    // Each thread sends its share of the total rate.
+    Clock::duration     interval    = options.rate == 0
+                                    ? Clock::duration::zero()
+                                    : std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(options.connections / options.rate));
+    Clock::time_point   scheduled   = start;
+
+    while(true)
+    {
+        Clock::time_point   now     = Clock::now();
+        if (interval != Clock::duration::zero())
+        {
+            if (scheduled >= end)
+            {
+                break;
+            }
+            if (now >= end)
+            {
+                // Behind schedule: the rest of the backlog is not sent
+                // (that would run past the end of the test).
+                result.unsent += (end - scheduled + interval - Clock::duration(1)) / interval;
+                break;
+            }
+            if (scheduled > now)
+            {
+                std::this_thread::sleep_until(scheduled);
+            }
+        }
+        else
+        {
+            if (now >= end)
+            {
+                break;
+            }
+            scheduled = now;
+        }
+
+        try
+        {
+            if (options.http)
+            {
+                connection.request(body);
+            }
+            else
+            {
+                simpleRequest(options, body);
+            }
+            result.latency.record(std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - scheduled).count());
+            ++result.completed;
+        }
+        catch(std::exception const&)
+        {
+            ++result.failed;
+        }
+        scheduled += interval;
+    }
+}
+
+void usage()
+{
+    std::cerr << "Usage: loadgen [-c <connections>] [-d <seconds>] [-r <requests/sec>] [-p simple|http] [-k] [-s <payload bytes>] [-P <port>] [<host>]\n";
+    std::exit(1);
+}
+
+int main(int argc, char* argv[])
+{
+    Options     options;
+    int         opt;
+    while((opt = ::getopt(argc, argv, "c:d:r:p:ks:P:")) != -1)
+    {
+        switch(opt)
+        {
+            case 'c':   options.connections = std::atoi(optarg);                break;
+            case 'd':   options.seconds     = std::atoi(optarg);                break;
+            case 'r':   options.rate        = std::atof(optarg);                break;
+            case 'p':   options.http        = std::strcmp(optarg, "http") == 0;
+                        if (!options.http && std::strcmp(optarg, "simple") != 0)
+                        {
+                            usage();
+                        }
+                        break;
+            case 'k':   options.keepAlive   = true;                             break;
+            case 's':   options.payload     = std::atol(optarg);                break;
+            case 'P':   options.port        = std::atoi(optarg);                break;
+            default:    usage();
+        }
+    }
+    if (optind + 1 < argc || options.connections <= 0 || options.seconds <= 0 || options.rate < 0)
+    {
+        usage();
+    }
+    if (optind < argc)
+    {
+        options.host = argv[optind];
+    }
+
+    Clock::time_point const     start   = Clock::now();
+    Clock::time_point const     end     = start + std::chrono::seconds(options.seconds);
+    std::vector<Result>         results(options.connections);
+    std::vector<std::thread>    clients;
+    for(auto& result: results)
+    {
+        clients.emplace_back(worker, std::cref(options), start, end, std::ref(result));
+    }
+    for(auto& client: clients)
+    {
+        client.join();
+    }
+    double  elapsed = std::chrono::duration<double>(Clock::now() - start).count();
+
+    Result  total;
+    for(auto const& result: results)
+    {
+        total.latency.merge(result.latency);
+        total.completed += result.completed;
+        total.failed    += result.failed;
+        total.unsent    += result.unsent;
+    }
+
+    auto micro = [](double nano){return nano / 1000;};
+    std::cout << std::fixed << std::setprecision(1)
+              << "Protocol:  " << (options.http ? "http" : "simple") << (options.http && options.keepAlive ? " (keep-alive)" : "") << "\n"
+              << "Requests:  " << total.completed << "\n"
+              << "Failed:    " << total.failed << "\n"
+              << "Seconds:   " << elapsed << "\n"
+              << "Req/Sec:   " << total.completed / elapsed << "\n";
+    if (options.rate != 0)
+    {
+        std::cout << "Target:    " << options.rate << " Req/Sec (latency from the scheduled send time)\n"
+                  << "Unsent:    " << total.unsent << " (scheduled but the test ended first)\n";
+    }
+    std::cout << "Latency (us)\n"
+              << "    min      " << micro(total.latency.min()) << "\n"
+              << "    mean     " << micro(total.latency.mean()) << "\n"
+              << "    p50      " << micro(total.latency.percentile(50)) << "\n"
+              << "    p90      " << micro(total.latency.percentile(90)) << "\n"
+              << "    p99      " << micro(total.latency.percentile(99)) << "\n"
+              << "    p99.9    " << micro(total.latency.percentile(99.9)) << "\n"
+              << "    max      " << micro(total.latency.max()) << "\n";
+}
@@ -0,0 +1,134 @@
+
+#include "HTTPScanner.h"
+#include <algorithm>
+#include <chrono>
+#include <string>
+#include <cstdio>
+#include <cstring>
+#include <cstdlib>
+#include <iostream>
+
+/*
+ * Header parsing throughput.
+ *
+ * Compares the original line at a time parser (std::search for "\r\n" then
+ * sscanf() for the start line and each header we care about) against
+ * HTTPScanner using each implementation supported by this CPU.
+ *
+ *      ./parse [<iterations>]
+ */
+
+namespace Sock = ThorsAnvil::Socket;
+
+static char const request[] =
+    "POST /api/v1/artifacts/upload?project=thors&branch=master HTTP/1.1\r\n"
+    "Host: build.example.com:8080\r\n"
+    "User-Agent: Mozilla/5.0 (X11; Linux x86_64) AppleWebKit/537.36 (KHTML, like Gecko) Chrome/70.0 Safari/537.36\r\n"
+    "Accept: text/html,application/xhtml+xml,application/xml;q=0.9,image/webp,*/*;q=0.8\r\n"
+    "Accept-Language: en-US,en;q=0.9\r\n"
+    "Accept-Encoding: gzip, deflate, br\r\n"
+    "Cookie: session=4f3c2b1a0e9d8c7b6a5f4e3d2c1b0a99; theme=dark; tracking=off\r\n"
+    "Cache-Control: no-cache\r\n"
+    "Content-Type: application/json\r\n"
+    "Content-Length: 1024\r\n"
+    "Connection: keep-alive\r\n"
+    "\r\n";
+
+// The parser from the original ProtocolHTTP.
+std::size_t sscanfParse(char const* data, std::size_t size)
+{
+    static constexpr char const* endOfLineSeq = "\r\n";
+    char const* end         = data + size;
+    char const* line        = data;
+    char const* lineEnd     = std::search(line, end, endOfLineSeq, endOfLineSeq + 2) + 2;
+
+    char    command[32];
+    char    url[4096];
+    char    version[32];
+    char    space1;
+    char    space2;
+    char    backslashR;
+    char    backslashN;
+    std::sscanf(line, "%s%c%s%c%s%c%c", command, &space1, url, &space2, version, &backslashR, &backslashN);
+
+    std::size_t contentLength   = 0;
+    char        connection[32];
+    for(line = lineEnd; (lineEnd = std::search(line, end, endOfLineSeq, endOfLineSeq + 2) + 2) - line > 2; line = lineEnd)
+    {
+        std::sscanf(line, "Transfer-Encoding : identity%c%c", &backslashR, &backslashN);
+        std::sscanf(line, "Content-Length : %lu%c%c", &contentLength, &backslashR, &backslashN);
+        std::sscanf(line, "Content-Type : multipart/byteranges%c%c", &backslashR, &backslashN);
+        std::sscanf(line, "Connection : %31[^\r\n]%c%c", connection, &backslashR, &backslashN);
+    }
+    return contentLength;
+}
+
+// The parser used by ProtocolHTTP now.
+std::size_t scannerParse(Sock::HTTPScanner& scanner, char const* data, std::size_t size)
+{
+    scanner.reset();
+    scanner.scan(data, size);
+
+    std::size_t contentLength   = 0;
+    auto const& lines           = scanner.getLines();
+    for(std::size_t loop = 1; loop < lines.size(); ++loop)
+    {
+        char const* nameBegin   = data + lines[loop].begin;
+        char const* nameEnd     = data + lines[loop].colon;
+        char const* valueBegin  = nameEnd + 1;
+        char const* valueEnd    = data + lines[loop].end;
+        Sock::HTTPScanner::trim(valueBegin, valueEnd);
+        if (Sock::HTTPScanner::equalIgnoreCase(nameBegin, nameEnd, "Content-Length"))
+        {
+            Sock::HTTPScanner::parseSize(valueBegin, valueEnd, contentLength);
+        }
+        else if (Sock::HTTPScanner::equalIgnoreCase(nameBegin, nameEnd, "Transfer-Encoding")
+              || Sock::HTTPScanner::equalIgnoreCase(nameBegin, nameEnd, "Content-Type")
+              || Sock::HTTPScanner::equalIgnoreCase(nameBegin, nameEnd, "Connection"))
+        {
+            Sock::HTTPScanner::equalIgnoreCase(valueBegin, valueEnd, "close");
+        }
+    }
+    return contentLength;
+}
+
+template<typename F>
+void report(char const* name, long iterations, F&& action)
+{
+    using Clock = std::chrono::steady_clock;
+    std::size_t         check   = 0;
+    Clock::time_point   start   = Clock::now();
+    for(long loop = 0; loop < iterations; ++loop)
+    {
+        check += action();
+    }
+    double  elapsed = std::chrono::duration<double>(Clock::now() - start).count();
+
+    if (check != static_cast<std::size_t>(iterations) * 1024)
+    {
+        std::cerr << name << ": Parse Failed\n";
+        std::exit(1);
+    }
+    std::cout << name << "\n"
+              << "    ns/Request:   " << elapsed * 1e9 / iterations << "\n"
+              << "    MB/Sec:       " << (sizeof(request) - 1) * iterations / elapsed / 1e6 << "\n";
+}
+
+int main(int argc, char* argv[])
+{
+    long            iterations  = argc == 2 ? std::atol(argv[1]) : 1000000;
+    std::size_t     size        = sizeof(request) - 1;
+
+    report("sscanf (original)", iterations, [size](){return sscanfParse(request, size);});
+
+    Sock::HTTPScanner   scanner;
+    for(auto impl: {Sock::HTTPScanner::Scalar, Sock::HTTPScanner::SSE42, Sock::HTTPScanner::AVX2})
+    {
+        if (!Sock::HTTPScanner::isSupported(impl))
+        {
+            continue;
+        }
+        Sock::HTTPScanner::setImplementation(impl);
+        report(Sock::HTTPScanner::getImplementationName(impl), iterations, [&scanner, size](){return scannerParse(scanner, request, size);});
+    }
+}
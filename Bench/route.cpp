@@ -0,0 +1,148 @@
+#include "Router.h"
+#include "Utility.h"
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <vector>
+#include <cstdlib>
+#include <iostream>
+#include <new>
+
+/*
+ * Router lookup cost.
+ *
+ * Builds a router with a few hundred routes (like a REST API: a collection,
+ * an item (:id) and its sub collections for each resource) then looks up
+ * a mix of static, parameter and unknown paths. Compares against scanning
+ * the list of routes segment by segment (the obvious implementation).
+ *
+ * Also counts the memory allocations made by the lookups (there should be none).
+ *
+ *      ./route [<iterations>]
+ */
+
+namespace Sock = ThorsAnvil::Socket;
+
+std::atomic<std::size_t>    allocations(0);
+
+void* operator new(std::size_t size)
+{
+    ++allocations;
+    if (void* result = std::malloc(size))
+    {
+        return result;
+    }
+    throw std::bad_alloc();
+}
+void operator delete(void* data) noexcept                   {std::free(data);}
+void operator delete(void* data, std::size_t) noexcept      {std::free(data);}
+
+void handler(Sock::HTTPServer&, Sock::RouteParams const&, std::string const&)
+{}
+
+struct ScanRoute
+{
+    Sock::RequestType   method;
+    std::string         path;
+};
+
+// Match segment by segment; a ":name" segment matches anything.
+bool scanMatch(std::string_view route, std::string_view path)
+{
+    while(!route.empty() && !path.empty())
+    {
+        std::size_t routeEnd    = std::min(route.find('/', 1), route.size());
+        std::size_t pathEnd     = std::min(path.find('/', 1), path.size());
+        if (route[1] != ':' && route.substr(0, routeEnd) != path.substr(0, pathEnd))
+        {
+            return false;
+        }
+        route.remove_prefix(routeEnd);
+        path.remove_prefix(pathEnd);
+    }
+    return route.empty() && path.empty();
+}
+
+template<typename F>
+double timeLookups(std::vector<std::string> const& paths, int iterations, F&& lookup)
+{
+    using Clock = std::chrono::steady_clock;
+    std::size_t         found   = 0;
+    Clock::time_point   start   = Clock::now();
+    for(int loop = 0; loop < iterations; ++loop)
+    {
+        for(auto const& path: paths)
+        {
+            found += lookup(path);
+        }
+    }
+    double  nanos   = std::chrono::duration<double, std::nano>(Clock::now() - start).count();
+    std::cout << "    found: " << found / iterations << "/" << paths.size();
+    return nanos / (static_cast<double>(iterations) * paths.size());
+}
+
+int main(int argc, char* argv[])
+{
+    int     iterations  = argc == 2 ? std::atoi(argv[1]) : 20000;
+
+    Sock::Router                router;
+    std::vector<ScanRoute>      scanRoutes;
+    auto addRoute = [&](Sock::RequestType method, std::string const& path)
+    {
+        router.add(method, path, handler);
+        scanRoutes.push_back({method, path});
+    };
+    char const* const resources[] = {"users", "groups", "projects", "builds", "artifacts", "tokens", "hooks",
+                                     "issues", "comments", "labels", "releases", "tags", "branches", "commits",
+                                     "reviews", "pipelines", "jobs", "runners", "secrets", "packages"};
+    for(char const* resource: resources)
+    {
+        std::string base = Sock::buildStringFromParts("/api/v1/", resource);
+        addRoute(Sock::Get,     base);
+        addRoute(Sock::Post,    base);
+        addRoute(Sock::Get,     base + "/:id");
+        addRoute(Sock::Put,     base + "/:id");
+        addRoute(Sock::Delete,  base + "/:id");
+        addRoute(Sock::Get,     base + "/search");
+        for(char const* sub: {"members", "events", "settings"})
+        {
+            addRoute(Sock::Get,     Sock::buildStringFromParts(base, "/:id/", sub));
+            addRoute(Sock::Post,    Sock::buildStringFromParts(base, "/:id/", sub));
+            addRoute(Sock::Get,     Sock::buildStringFromParts(base, "/:id/", sub, "/:item"));
+        }
+    }
+
+    std::vector<std::string>    paths;
+    for(char const* resource: resources)
+    {
+        paths.push_back(Sock::buildStringFromParts("/api/v1/", resource));
+        paths.push_back(Sock::buildStringFromParts("/api/v1/", resource, "/search"));
+        paths.push_back(Sock::buildStringFromParts("/api/v1/", resource, "/12345"));
+        paths.push_back(Sock::buildStringFromParts("/api/v1/", resource, "/12345/settings/theme"));
+        paths.push_back(Sock::buildStringFromParts("/api/v1/", resource, "/12345/unknown"));
+    }
+
+    std::cout << "Routes: " << scanRoutes.size() << "  Paths: " << paths.size() << "\n";
+
+    std::size_t before  = allocations;
+    double      trie    = timeLookups(paths, iterations, [&router](std::string const& path)
+    {
+        Sock::RouteParams   params;
+        unsigned int        allowed;
+        return router.find(Sock::Get, path, params, allowed) != nullptr;
+    });
+    std::cout << "    Router:  " << trie << " ns/lookup  allocations: " << allocations - before << "\n";
+
+    double      scan    = timeLookups(paths, iterations, [&scanRoutes](std::string const& path)
+    {
+        for(auto const& route: scanRoutes)
+        {
+            if (route.method == Sock::Get && scanMatch(route.path, path))
+            {
+                return true;
+            }
+        }
+        return false;
+    });
+    std::cout << "    Scan:    " << scan << " ns/lookup\n";
+}
@@ -0,0 +1,41 @@
+#!/bin/sh
+#
+# Reports how requests/sec scales with the number of server workers.
+# Runs the server with 1, 2, 4, ... workers (up to the core count)
+# and drives each configuration with ./throughput.
+#
+# Usage: ./scaling.sh [<server> [<simple|http> [<seconds>]]]
+#
+# Note: The load generator runs on the same machine so it competes with
+#       the server for cores. The server workers are pinned to the first
+#       N cores (when taskset is available) to keep the numbers honest.
+
+SERVER=${1:-../Version3/serverthreaded}
+PROTOCOL=${2:-http}
+DURATION=${3:-5}
+CORES=$(nproc)
+
+run()
+{
+    workers=$1
+    if command -v taskset > /dev/null
+    then
+        taskset -c 0-$((workers - 1)) ${SERVER} ${workers} > /dev/null &
+    else
+        ${SERVER} ${workers} > /dev/null &
+    fi
+    pid=$!
+    sleep 1
+    rate=$(./throughput 127.0.0.1 ${PROTOCOL} $((workers * 4)) ${DURATION} | awk '/Req\/Sec/ {print $2}')
+    kill ${pid}
+    wait ${pid} 2> /dev/null
+    echo "Workers: ${workers}  Req/Sec: ${rate}"
+}
+
+workers=1
+while [ ${workers} -lt ${CORES} ]
+do
+    run ${workers}
+    workers=$((workers * 2))
+done
+run ${CORES}
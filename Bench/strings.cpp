@@ -0,0 +1,87 @@
+
+#include "Utility.h"
+#include <chrono>
+#include <string>
+#include <sstream>
+#include <cstring>
+#include <cstdlib>
+#include <cerrno>
+#include <iostream>
+
+/*
+ * String building cost.
+ *
+ * Compares the original stream based buildStringFromParts() against the
+ * version in Utility.h (exact size up front, to_chars() for integers) and
+ * against buildStringInto() writing to a caller provided buffer.
+ *
+ * Uses the typical parts: a header line with a length and an error message.
+ *
+ *      ./strings [<iterations>]
+ */
+
+namespace Sock = ThorsAnvil::Socket;
+
+// The original implementation from Utility.h.
+template<typename... Args>
+std::string streamBuildStringFromParts(Args const&... args)
+{
+    std::stringstream msg;
+    Sock::print(msg, args...);
+    return msg.str();
+}
+
+template<typename F>
+void report(char const* name, long iterations, F&& action)
+{
+    using Clock = std::chrono::steady_clock;
+    std::size_t         check   = 0;
+    Clock::time_point   start   = Clock::now();
+    for(long loop = 0; loop < iterations; ++loop)
+    {
+        check += action(loop);
+    }
+    double  elapsed = std::chrono::duration<double>(Clock::now() - start).count();
+
+    // Use the result so the work is not optimized away.
+    if (check == 0)
+    {
+        std::cerr << name << ": Build Failed\n";
+        std::exit(1);
+    }
+    std::cout << name << "\n"
+              << "    ns/String:    " << elapsed * 1e9 / iterations << "\n";
+}
+
+int main(int argc, char* argv[])
+{
+    long            iterations  = argc == 2 ? std::atol(argv[1]) : 1000000;
+    char const*     error       = std::strerror(ECONNRESET);
+
+    std::cout << "Header Line: Content-Length: <n>\\r\\n\n";
+    report("stringstream (original)", iterations, [](long loop)
+    {
+        return streamBuildStringFromParts("Content-Length: ", static_cast<std::size_t>(loop), "\r\n").size();
+    });
+    report("buildStringFromParts", iterations, [](long loop)
+    {
+        return Sock::buildStringFromParts("Content-Length: ", static_cast<std::size_t>(loop), "\r\n").size();
+    });
+    report("buildStringInto (no allocation)", iterations, [](long loop)
+    {
+        char    buffer[64];
+        char*   end = Sock::buildStringInto(buffer, buffer + sizeof(buffer), "Content-Length: ", static_cast<std::size_t>(loop), "\r\n");
+        // Use the first digit so the formatting is not optimized away.
+        return static_cast<std::size_t>(end - buffer) + buffer[16];
+    });
+
+    std::cout << "\nError Message\n";
+    report("stringstream (original)", iterations, [error](long loop)
+    {
+        return streamBuildStringFromParts("DataSocket::", __func__, ": write: socket: ", static_cast<int>(loop), ": ", error).size();
+    });
+    report("buildErrorMessage", iterations, [error](long loop)
+    {
+        return Sock::buildErrorMessage("DataSocket::", __func__, ": write: socket: ", static_cast<int>(loop), ": ", error).size();
+    });
+}
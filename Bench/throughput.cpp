@@ -0,0 +1,199 @@
+
+#include "Socket.h"
+#include "ProtocolSimple.h"
+#include "ProtocolHTTP.h"
+#include "ProtocolFramed.h"
+#include "ConnectionPool.h"
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
+#include <cstdlib>
+#include <cstring>
+#include <stdexcept>
+#include <iostream>
+
+/*
+ * Closed loop throughput test.
+ *
+ * Runs <connections> client threads against a server for <seconds>.
+ * Each thread repeatedly connects, sends a message and waits for the reply.
+ * In "keepalive" mode each thread opens one HTTP connection and sends all
+ * its requests over it. In "pooled" mode each request is a new HTTPPost
+ * object (like "http") but the connection is borrowed from a shared
+ * ConnectionPool (so is only opened once). In "framed" mode each thread
+ * opens one ProtocolFramed connection and keeps a window of requests in
+ * flight (run against serverframed).
+ *
+ * Optionally opens <idle> connections first that never send anything.
+ * These simulate slow clients. The blocking servers (server) will stall
+ * behind the first of these (so the test never completes) while the event
+ * loop servers (serverepoll) keep serving everybody else.
+ *
+ *      ./server &       ./throughput 127.0.0.1 simple 8 5 1
+ *      ./serverepoll &  ./throughput 127.0.0.1 simple 8 5 1
+ *      ./serverframed & ./throughput 127.0.0.1 framed 8 5
+ */
+
+namespace Sock = ThorsAnvil::Socket;
+
+void simpleRequest(std::string const& host)
+{
+    Sock::ConnectSocket    connect(host, 8080);
+    Sock::ProtocolSimple   simpleConnect(connect);
+    simpleConnect.sendMessage("", "ping");
+
+    std::string message;
+    simpleConnect.recvMessage(message);
+}
+
+void httpRequest(std::string const& host)
+{
+    Sock::ConnectSocket    connect(host, 8080);
+    Sock::HTTPPost         httpConnect(host, connect);
+    httpConnect.sendMessage("/message", "ping");
+
+    std::string message;
+    httpConnect.recvMessage(message);
+}
+
+void pooledRequest(std::string const& host, Sock::ConnectionPool& pool)
+{
+    Sock::HTTPPost         httpConnect(host, pool.checkout(host, 8080));
+    httpConnect.sendMessage("/message", "ping");
+
+    std::string message;
+    httpConnect.recvMessage(message);
+}
+
+template<typename Clock>
+long keepAliveRequests(std::string const& host, typename Clock::time_point end)
+{
+    Sock::ConnectSocket    connect(host, 8080);
+    Sock::HTTPPost         httpConnect(host, connect);
+
+    long count = 0;
+    while(Clock::now() < end && httpConnect.keepAlive())
+    {
+        httpConnect.sendMessage("/message", "ping");
+
+        std::string message;
+        httpConnect.recvMessage(message);
+        ++count;
+    }
+    return count;
+}
+
+// Requests sent before waiting for the responses.
+constexpr int framedWindow = 16;
+
+template<typename Clock>
+long framedRequests(std::string const& host, typename Clock::time_point end)
+{
+    Sock::ConnectSocket    connect(host, 8080);
+    Sock::ProtocolFramed   framedConnect(connect);
+
+    long count = 0;
+    std::string message;
+    while(Clock::now() < end)
+    {
+        std::uint64_t first = 0;
+        for(int loop = 0; loop < framedWindow; ++loop)
+        {
+            std::uint64_t streamId = framedConnect.sendRequest("/message", "ping");
+            first = loop == 0 ? streamId : first;
+        }
+        for(int loop = 0; loop < framedWindow; ++loop)
+        {
+            framedConnect.recvMessage(message);
+            if (framedConnect.getFrame().streamId != first + loop)
+            {
+                throw std::runtime_error("Response out of order");
+            }
+        }
+        count += framedWindow;
+    }
+    return count;
+}
+
+int main(int argc, char* argv[])
+{
+    if (argc != 5 && argc != 6)
+    {
+        std::cerr << "Usage: throughput <host> <simple|http|keepalive|pooled|framed> <connections> <seconds> [<idle>]\n";
+        std::exit(1);
+    }
+    std::string     host        = argv[1];
+    bool            http        = std::strcmp(argv[2], "http") == 0;
+    bool            keepAlive   = std::strcmp(argv[2], "keepalive") == 0;
+    bool            pooled      = std::strcmp(argv[2], "pooled") == 0;
+    bool            framed      = std::strcmp(argv[2], "framed") == 0;
+    int             connections = std::atoi(argv[3]);
+    int             seconds     = std::atoi(argv[4]);
+    int             idle        = argc == 6 ? std::atoi(argv[5]) : 0;
+
+    std::vector<Sock::ConnectSocket>    idleConnections;
+    for(int loop = 0; loop < idle; ++loop)
+    {
+        idleConnections.emplace_back(host, 8080);
+    }
+
+    using Clock = std::chrono::steady_clock;
+    Clock::time_point const     start   = Clock::now();
+    Clock::time_point const     end     = start + std::chrono::seconds(seconds);
+    std::atomic<long>           completed(0);
+    std::atomic<long>           failed(0);
+    Sock::ConnectionPool        pool(connections);
+
+    std::vector<std::thread>    clients;
+    for(int loop = 0; loop < connections; ++loop)
+    {
+        clients.emplace_back([&]()
+        {
+            while(Clock::now() < end)
+            {
+                try
+                {
+                    if (keepAlive)
+                    {
+                        completed += keepAliveRequests<Clock>(host, end);
+                        continue;
+                    }
+                    if (framed)
+                    {
+                        completed += framedRequests<Clock>(host, end);
+                        continue;
+                    }
+                    if (pooled)
+                    {
+                        pooledRequest(host, pool);
+                        ++completed;
+                        continue;
+                    }
+                    http ? httpRequest(host) : simpleRequest(host);
+                    ++completed;
+                }
+                catch(std::exception const&)
+                {
+                    ++failed;
+                }
+            }
+        });
+    }
+    for(auto& client: clients)
+    {
+        client.join();
+    }
+
+    double  elapsed = std::chrono::duration<double>(Clock::now() - start).count();
+    std::cout << "Requests:  " << completed << "\n"
+              << "Failed:    " << failed << "\n"
+              << "Seconds:   " << elapsed << "\n"
+              << "Req/Sec:   " << completed / elapsed << "\n";
+    if (pooled)
+    {
+        Sock::ConnectionPool::Stats stats = pool.getStats();
+        std::cout << "Opened:    " << stats.created << "\n"
+                  << "Reused:    " << stats.reused << "\n";
+    }
+}
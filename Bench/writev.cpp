@@ -0,0 +1,105 @@
+
+#include "Socket.h"
+#include "ProtocolHTTP.h"
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <fstream>
+#include <iomanip>
+#include <sstream>
+#include <ctime>
+#include <cstdlib>
+#include <iostream>
+
+/*
+ * Compare sending an HTTP response one part per write() against
+ * HTTPServer::sendMessage() which gathers the parts into a single writev().
+ *
+ * Runs over a loopback TCP connection with a thread draining the other end.
+ * The number of write system calls is taken from /proc/self/io (syscw).
+ *
+ *      ./writev [<responses>]
+ */
+
+namespace Sock = ThorsAnvil::Socket;
+
+long writeSyscalls()
+{
+    std::ifstream   io("/proc/self/io");
+    std::string     name;
+    long            value;
+    while(io >> name >> value)
+    {
+        if (name == "syscw:")
+        {
+            return value;
+        }
+    }
+    return 0;
+}
+
+template<typename F>
+void report(char const* name, int responses, F&& action)
+{
+    using Clock = std::chrono::steady_clock;
+    long                startCalls  = writeSyscalls();
+    Clock::time_point   start       = Clock::now();
+    for(int loop = 0; loop < responses; ++loop)
+    {
+        action();
+    }
+    double  elapsed = std::chrono::duration<double>(Clock::now() - start).count();
+    long    calls   = writeSyscalls() - startCalls;
+
+    std::cout << name << "\n"
+              << "    Syscalls/Response:  " << static_cast<double>(calls) / responses << "\n"
+              << "    Responses/Sec:      " << responses / elapsed << "\n";
+}
+
+int main(int argc, char* argv[])
+{
+    int                 responses   = argc == 2 ? std::atoi(argv[1]) : 200000;
+    std::string const   body(64, 'X');
+
+    Sock::ServerSocket      server(8091, true);
+    Sock::ConnectSocket     client("127.0.0.1", 8091);
+    Sock::DataSocket        accept = server.accept();
+    // Both versions run with Nagle disabled (as HTTPServer does).
+    accept.setNoDelay();
+
+    std::atomic<bool>       finished(false);
+    std::thread             drain([&client, &finished]()
+    {
+        char buffer[64 * 1024];
+        while(client.getMessageData(buffer, sizeof(buffer), [](std::size_t){return true;}) != 0 && !finished)
+        {}
+    });
+
+    report("write() per part", responses, [&accept, &body]()
+    {
+        // What HTTPServer::sendMessage() used to do.
+        std::time_t t = std::time(nullptr);
+        std::tm tm = *std::localtime(&t);
+        std::stringstream   dateStream;
+        dateStream << "Date: " << std::put_time(&tm, "%c %Z") << "\r\n";
+        std::string const   date   = dateStream.str();
+        std::string const   length = Sock::buildStringFromParts("Content-Length: ", body.size(), "\r\n");
+        accept.putMessageData("HTTP/1.1 200 OK\r\n", 17);
+        accept.putMessageData(date.data(), date.size());
+        accept.putMessageData("Server: ThorsExperimental-Server/0.1\r\n", 38);
+        accept.putMessageData(length.data(), length.size());
+        accept.putMessageData("Content-Type: text/text\r\n", 25);
+        accept.putMessageData("\r\n", 2);
+        accept.putMessageData(body.data(), body.size());
+    });
+
+    Sock::HTTPServer    httpServer(accept);
+    report("HTTPServer::sendMessage() writev()", responses, [&httpServer, &body]()
+    {
+        httpServer.sendMessage("", body);
+    });
+
+    finished = true;
+    accept.putMessageClose();
+    drain.join();
+}
@@ -0,0 +1,235 @@
+
+#include "Async.h"
+#include "Utility.h"
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <cstring>
+#include <cerrno>
+#include <cstdint>
+#include <stdexcept>
+#include <iostream>
+
+using namespace ThorsAnvil::Socket;
+
+namespace
+{
+    // Owns a spawned task.
+    // Starts immediately and the frame is destroyed when it completes.
+    struct Detached
+    {
+        struct promise_type
+        {
+            Detached            get_return_object()         {return {};}
+            std::suspend_never  initial_suspend() noexcept  {return {};}
+            std::suspend_never  final_suspend() noexcept    {return {};}
+            void                return_void()               {}
+            void                unhandled_exception()       {std::terminate();}
+        };
+    };
+
+    Detached runDetached(Async<void> task)
+    {
+        try
+        {
+            co_await task;
+        }
+        catch(std::exception const& e)
+        {
+            // TODO: LOGGING CODE HERE
+            std::cerr << "AsyncLoop: task dropped: " << e.what() << "\n";
+        }
+        catch(...)
+        {
+            std::cerr << "AsyncLoop: task dropped: unknown exception\n";
+        }
+    }
+}
+
+AsyncLoop::AsyncLoop()
+    : epollId(::epoll_create1(EPOLL_CLOEXEC))
+    , finished(false)
+{
+    if (epollId == -1)
+    {
+        throw std::runtime_error(buildErrorMessage("AsyncLoop::", __func__, ": epoll_create1: ", strerror(errno)));
+    }
+    ready.reserve(maxEvents * 2);
+}
+
+AsyncLoop::~AsyncLoop()
+{
+    ::close(epollId);
+}
+
+void AsyncLoop::spawn(Async<void>&& task)
+{
+    runDetached(std::move(task));
+}
+
+void AsyncLoop::run()
+{
+    finished = false;
+
+    epoll_event     events[maxEvents];
+    while(!finished)
+    {
+        int count = ::epoll_wait(epollId, events, maxEvents, -1);
+        if (count == -1)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            throw std::runtime_error(buildErrorMessage("AsyncLoop::", __func__, ": epoll_wait: ", strerror(errno)));
+        }
+
+        // Collect everything that can run before resuming anything.
+        // A resumed coroutine may destroy sockets referred to by later events.
+        ready.clear();
+        for(int loop = 0; loop < count; ++loop)
+        {
+            AsyncWaiters&   waiters = *static_cast<AsyncWaiters*>(events[loop].data.ptr);
+            std::uint32_t   event   = events[loop].events;
+            // An error or hangup wakes both so the retried operation can report it.
+            if ((event & (EPOLLIN | EPOLLRDHUP | EPOLLERR | EPOLLHUP)) && waiters.reader)
+            {
+                ready.emplace_back(std::exchange(waiters.reader, nullptr));
+            }
+            if ((event & (EPOLLOUT | EPOLLERR | EPOLLHUP)) && waiters.writer)
+            {
+                ready.emplace_back(std::exchange(waiters.writer, nullptr));
+            }
+        }
+        for(auto coroutine: ready)
+        {
+            coroutine.resume();
+        }
+    }
+}
+
+void AsyncLoop::stop()
+{
+    finished = true;
+}
+
+void AsyncLoop::watch(int socketId, AsyncWaiters& waiters)
+{
+    // Edge triggered: We are only told when the state changes.
+    // Which is fine as an operation only waits after it gets EAGAIN.
+    epoll_event     event{};
+    event.events    = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+    event.data.ptr  = &waiters;
+    if (::epoll_ctl(epollId, EPOLL_CTL_ADD, socketId, &event) != 0)
+    {
+        throw std::runtime_error(buildErrorMessage("AsyncLoop::", __func__, ": epoll_ctl: ", strerror(errno)));
+    }
+}
+
+void AsyncLoop::unwatch(int socketId)
+{
+    ::epoll_ctl(epollId, EPOLL_CTL_DEL, socketId, nullptr);
+}
+
+AsyncSocket::AsyncSocket(AsyncLoop& loop, DataSocket&& dataSocket)
+    : loop(loop)
+    , socket(std::move(dataSocket))
+{
+    // No yield functions: the operations below never call the blocking versions.
+    socket.setNonBlocking(nullptr, nullptr);
+    loop.watch(socket.getSocketId(), waiters);
+}
+
+AsyncSocket::~AsyncSocket()
+{
+    loop.unwatch(socket.getSocketId());
+}
+
+Async<std::size_t> AsyncSocket::read(char* buffer, std::size_t size)
+{
+    while(true)
+    {
+        ssize_t get = socket.ioRead(buffer, size);
+        if (get != -1)
+        {
+            co_return get;
+        }
+        switch(errno)
+        {
+            case EINTR:
+                continue;
+            case EAGAIN:
+                co_await AsyncWait{waiters.reader};
+                continue;
+            case ECONNRESET:
+            case ENOTCONN:
+                // Connection broken.
+                // Treat it as if the connection was closed correctly.
+                co_return 0;
+            default:
+                throw std::runtime_error(buildErrorMessage("AsyncSocket::", __func__, ": read: ", strerror(errno)));
+        }
+    }
+}
+
+Async<void> AsyncSocket::write(char const* buffer, std::size_t size)
+{
+    std::size_t     dataWritten = 0;
+    while(dataWritten < size)
+    {
+        ssize_t put = socket.ioWrite(buffer + dataWritten, size - dataWritten);
+        if (put != -1)
+        {
+            dataWritten += put;
+            continue;
+        }
+        switch(errno)
+        {
+            case EINTR:
+                continue;
+            case EAGAIN:
+                co_await AsyncWait{waiters.writer};
+                continue;
+            default:
+                throw std::runtime_error(buildErrorMessage("AsyncSocket::", __func__, ": write: ", strerror(errno)));
+        }
+    }
+}
+
+AsyncServerSocket::AsyncServerSocket(AsyncLoop& loop, int port, bool reusePort)
+    : loop(loop)
+    , server(port, reusePort)
+{
+    server.setNonBlocking(nullptr, nullptr);
+    loop.watch(server.getSocketId(), waiters);
+}
+
+AsyncServerSocket::~AsyncServerSocket()
+{
+    loop.unwatch(server.getSocketId());
+}
+
+Async<DataSocket> AsyncServerSocket::accept()
+{
+    while(true)
+    {
+        // Non-blocking from the start (so AsyncSocket does not need to change it).
+        int newSocket = server.ioAccept(SOCK_NONBLOCK);
+        if (newSocket != -1)
+        {
+            co_return DataSocket(newSocket, true);
+        }
+        switch(errno)
+        {
+            case EINTR:
+            case ECONNABORTED:
+                // The pending connection went away before we got to it.
+                continue;
+            case EAGAIN:
+                co_await AsyncWait{waiters.reader};
+                continue;
+            default:
+                throw std::runtime_error(buildErrorMessage("AsyncServerSocket::", __func__, ": accept: ", strerror(errno)));
+        }
+    }
+}
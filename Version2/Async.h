@@ -0,0 +1,231 @@
+
+#ifndef THORSANVIL_SOCKET_ASYNC_H
+#define THORSANVIL_SOCKET_ASYNC_H
+
+// Requires C++20 (coroutines).
+
+#include "Socket.h"
+#include <coroutine>
+#include <exception>
+#include <optional>
+#include <utility>
+#include <vector>
+#include <cstddef>
+
+namespace ThorsAnvil
+{
+    namespace Socket
+    {
+
+/*
+ * A C++20 coroutine API for sockets.
+ *
+ * The EventLoop gives each connection its own stack so the blocking style
+ * Protocol classes can be suspended anywhere. The classes here do the same
+ * job with stackless coroutines: a handler is written straight-line using
+ * co_await and only its coroutine frame (not a 128K stack) is kept for
+ * each connection.
+ *
+ *      Async<void> handle(AsyncLoop& loop, DataSocket accepted)
+ *      {
+ *          AsyncSocket         socket(loop, std::move(accepted));
+ *          AsyncProtocolSimple protocol(socket);
+ *          std::string         message;
+ *          co_await protocol.recvMessage(message);
+ *          co_await protocol.sendMessage("", "OK");
+ *      }
+ *      Async<void> listen(AsyncLoop& loop, AsyncServerSocket& server)
+ *      {
+ *          while(true)
+ *          {
+ *              loop.spawn(handle(loop, co_await server.accept()));
+ *          }
+ *      }
+ *
+ * An AsyncLoop is single threaded. To use several threads run one loop per
+ * thread each with its own AsyncServerSocket opened with `reusePort`
+ * (as the WorkerPool does).
+ */
+
+// The return type of a coroutine that produces a T.
+// The coroutine does not start until it is awaited (or passed to AsyncLoop::spawn()).
+// Exceptions thrown by the coroutine are re-thrown by the co_await.
+template<typename T = void>
+class Async;
+
+template<typename T>
+struct AsyncResult
+{
+    std::optional<T>    value;
+    void return_value(T result) {value.emplace(std::move(result));}
+    T    getResult()            {return std::move(*value);}
+};
+template<>
+struct AsyncResult<void>
+{
+    void return_void()          {}
+    void getResult()            {}
+};
+
+template<typename T>
+class Async
+{
+    public:
+        struct promise_type: public AsyncResult<T>
+        {
+            std::coroutine_handle<>     continuation;
+            std::exception_ptr          exception;
+
+            Async                   get_return_object()         {return Async(Handle::from_promise(*this));}
+            std::suspend_always     initial_suspend() noexcept  {return {};}
+            void                    unhandled_exception()       {exception = std::current_exception();}
+
+            // When the coroutine completes transfer straight back to whoever awaited it.
+            struct FinalAwaiter
+            {
+                bool await_ready() noexcept {return false;}
+                std::coroutine_handle<> await_suspend(std::coroutine_handle<promise_type> self) noexcept
+                {
+                    std::coroutine_handle<> next = self.promise().continuation;
+                    return next ? next : std::noop_coroutine();
+                }
+                void await_resume() noexcept {}
+            };
+            FinalAwaiter            final_suspend() noexcept    {return {};}
+        };
+        using Handle = std::coroutine_handle<promise_type>;
+    private:
+        Handle      handle;
+
+        explicit Async(Handle handle)
+            : handle(handle)
+        {}
+    public:
+        ~Async()
+        {
+            if (handle)
+            {
+                handle.destroy();
+            }
+        }
+        Async(Async&& move) noexcept
+            : handle(std::exchange(move.handle, nullptr))
+        {}
+        Async& operator=(Async&& move) noexcept
+        {
+            std::swap(handle, move.handle);
+            return *this;
+        }
+        Async(Async const&)             = delete;
+        Async& operator=(Async const&)  = delete;
+
+        bool await_ready() const noexcept
+        {
+            return handle.done();
+        }
+        std::coroutine_handle<> await_suspend(std::coroutine_handle<> awaiting) noexcept
+        {
+            handle.promise().continuation = awaiting;
+            return handle;
+        }
+        T await_resume()
+        {
+            if (handle.promise().exception)
+            {
+                std::rethrow_exception(handle.promise().exception);
+            }
+            return handle.promise().getResult();
+        }
+};
+
+// The coroutines waiting on a socket.
+// Only one reader and one writer can wait on a socket at a time.
+struct AsyncWaiters
+{
+    std::coroutine_handle<>     reader;
+    std::coroutine_handle<>     writer;
+};
+
+// A single threaded scheduler built on epoll.
+//
+// Sockets are registered once (edge triggered) when they are created.
+// An operation is always tried first; only if it would block does the
+// coroutine suspend until epoll reports the socket is ready.
+class AsyncLoop
+{
+    friend class AsyncSocket;
+    friend class AsyncServerSocket;
+
+    static constexpr int maxEvents = 256;
+
+    int                                     epollId;
+    bool                                    finished;
+    std::vector<std::coroutine_handle<>>    ready;
+
+    void watch(int socketId, AsyncWaiters& waiters);
+    void unwatch(int socketId);
+    public:
+        AsyncLoop();
+        ~AsyncLoop();
+        AsyncLoop(AsyncLoop const&)             = delete;
+        AsyncLoop& operator=(AsyncLoop const&)  = delete;
+
+        // Start `task` (it runs until it first suspends).
+        // The loop owns the task; an exception ends the task and is logged.
+        void spawn(Async<void>&& task);
+
+        // Run until stop() is called.
+        void run();
+        void stop();
+};
+
+// Suspends the coroutine in `waiting` until the loop resumes it.
+struct AsyncWait
+{
+    std::coroutine_handle<>&    waiting;
+
+    bool await_ready() const noexcept                       {return false;}
+    void await_suspend(std::coroutine_handle<> awaiting)    {waiting = awaiting;}
+    void await_resume() const noexcept                      {}
+};
+
+// A connected socket whose reads and writes are awaitable.
+// Note: Not movable (the loop refers to it while it exists).
+class AsyncSocket
+{
+    AsyncLoop&      loop;
+    DataSocket      socket;
+    AsyncWaiters    waiters;
+    public:
+        AsyncSocket(AsyncLoop& loop, DataSocket&& socket);
+        ~AsyncSocket();
+        AsyncSocket(AsyncSocket const&)             = delete;
+        AsyncSocket& operator=(AsyncSocket const&)  = delete;
+
+        // Read what is available (at most `size` bytes).
+        // Returns 0 when the connection is closed.
+        Async<std::size_t>  read(char* buffer, std::size_t size);
+        // Write all `size` bytes.
+        Async<void>         write(char const* buffer, std::size_t size);
+        void                putMessageClose()   {socket.putMessageClose();}
+};
+
+// A listening socket with an awaitable accept.
+class AsyncServerSocket
+{
+    AsyncLoop&      loop;
+    ServerSocket    server;
+    AsyncWaiters    waiters;
+    public:
+        AsyncServerSocket(AsyncLoop& loop, int port, bool reusePort = false);
+        ~AsyncServerSocket();
+        AsyncServerSocket(AsyncServerSocket const&)             = delete;
+        AsyncServerSocket& operator=(AsyncServerSocket const&)  = delete;
+
+        Async<DataSocket>   accept();
+};
+
+    }
+}
+
+#endif
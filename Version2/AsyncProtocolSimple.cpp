@@ -0,0 +1,52 @@
+
+#include "AsyncProtocolSimple.h"
+
+using namespace ThorsAnvil::Socket;
+
+namespace
+{
+    // Same as the Protocol classes.
+    constexpr std::size_t sinkBufferSize = 4096;
+}
+
+Async<void> AsyncProtocolSimple::sendMessage(std::string const& url, std::string const& message)
+{
+    co_await socket.write(url.c_str(), url.size());
+    co_await socket.write(message.c_str(), message.size());
+    socket.putMessageClose();
+}
+
+Async<void> AsyncProtocolSimple::recvMessage(std::string& message)
+{
+    std::size_t     dataRead = 0;
+    message.clear();
+
+    while(true)
+    {
+        // Open the string up to its capacity and read directly into it.
+        message.resize(message.capacity());
+        if (dataRead == message.size())
+        {
+            message.resize(message.size() * 1.5 + 10);
+        }
+        std::size_t got = co_await socket.read(&message[dataRead], message.size() - dataRead);
+        dataRead += got;
+        if (got == 0)
+        {
+            break;
+        }
+    }
+    message.resize(dataRead);
+}
+
+Async<void> AsyncProtocolSimple::recvMessage(MessageSink const& sink)
+{
+    char            buffer[sinkBufferSize];
+
+    // Pass on each block as soon as it is read.
+    std::size_t got;
+    while((got = co_await socket.read(buffer, sinkBufferSize)) != 0)
+    {
+        sink(buffer, got);
+    }
+}
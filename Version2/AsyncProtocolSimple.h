@@ -0,0 +1,35 @@
+
+#ifndef THORSANVIL_SOCKET_ASYNC_PROTOCOL_SIMPLE_H
+#define THORSANVIL_SOCKET_ASYNC_PROTOCOL_SIMPLE_H
+
+// Requires C++20 (coroutines).
+
+#include "Async.h"
+#include "Protocol.h"
+#include <string>
+
+namespace ThorsAnvil
+{
+    namespace Socket
+    {
+
+// The same protocol as ProtocolSimple with awaitable send/recv.
+//      co_await protocol.recvMessage(message);
+class AsyncProtocolSimple
+{
+    AsyncSocket&    socket;
+    public:
+        AsyncProtocolSimple(AsyncSocket& socket)
+            : socket(socket)
+        {}
+
+        Async<void> sendMessage(std::string const& url, std::string const& message);
+        Async<void> recvMessage(std::string& message);
+        // Pass the body to `sink` as it is read from the socket.
+        Async<void> recvMessage(MessageSink const& sink);
+};
+
+    }
+}
+
+#endif
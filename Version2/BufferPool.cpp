@@ -0,0 +1,181 @@
+
+#include "BufferPool.h"
+#include "Utility.h"
+#include <stdexcept>
+#include <cstring>
+#include <cerrno>
+#include <sys/mman.h>
+#include <unistd.h>
+
+using namespace ThorsAnvil::Socket;
+
+BufferPool::Buffer::~Buffer()
+{
+    if (buffer != nullptr)
+    {
+        pool->release(buffer, bufferSize);
+    }
+}
+
+BufferPool::Buffer& BufferPool::Buffer::operator=(Buffer&& move) noexcept
+{
+    if (this != &move)
+    {
+        if (buffer != nullptr)
+        {
+            pool->release(buffer, bufferSize);
+        }
+        pool        = move.pool;
+        buffer      = move.buffer;
+        bufferSize  = move.bufferSize;
+        move.buffer = nullptr;
+    }
+    return *this;
+}
+
+BufferPool::BufferPool(std::size_t bufferSize, std::size_t maxFree)
+    : bufferSize(0)
+    , maxFree(maxFree)
+    , stats{0, 0, 0, 0}
+    , observer(nullptr)
+{
+    setBufferSize(bufferSize);
+    freeList.reserve(maxFree);
+}
+
+BufferPool::~BufferPool()
+{
+    for(char* buffer: freeList)
+    {
+        freeMirrored(buffer, bufferSize);
+    }
+}
+
+BufferPool::Buffer BufferPool::acquire()
+{
+    if (freeList.empty())
+    {
+        ++stats.misses;
+        return Buffer(*this, create(bufferSize), bufferSize);
+    }
+    ++stats.hits;
+    char* buffer = freeList.back();
+    freeList.pop_back();
+    return Buffer(*this, buffer, bufferSize);
+}
+
+void BufferPool::release(char* buffer, std::size_t size)
+{
+    if (freeList.size() == maxFree || size != bufferSize)
+    {
+        // Don't hold on to the memory from a burst of connections forever.
+        ++stats.discards;
+        destroy(buffer, size);
+        return;
+    }
+    ++stats.returns;
+    freeList.push_back(buffer);
+}
+
+void BufferPool::setBufferSize(std::size_t size)
+{
+    if (size == 0)
+    {
+        throw std::domain_error(buildErrorMessage("BufferPool::", __func__, ": size must not be zero"));
+    }
+    for(char* buffer: freeList)
+    {
+        destroy(buffer, bufferSize);
+    }
+    freeList.clear();
+
+    // The mirror is built with mmap() so must be a whole number of pages.
+    std::size_t pageSize = ::sysconf(_SC_PAGESIZE);
+    bufferSize = (size + pageSize - 1) / pageSize * pageSize;
+}
+
+void BufferPool::setObserver(Observer* newObserver)
+{
+    observer = newObserver;
+    if (observer != nullptr)
+    {
+        for(char* buffer: freeList)
+        {
+            observer->bufferCreated(buffer, 2 * bufferSize);
+        }
+    }
+}
+
+char* BufferPool::create(std::size_t size)
+{
+    char* buffer = allocateMirrored(size);
+    if (observer != nullptr)
+    {
+        observer->bufferCreated(buffer, 2 * size);
+    }
+    return buffer;
+}
+
+void BufferPool::destroy(char* buffer, std::size_t size)
+{
+    if (observer != nullptr)
+    {
+        observer->bufferDestroyed(buffer, 2 * size);
+    }
+    freeMirrored(buffer, size);
+}
+
+/*
+ * Map the same memory (a memfd) twice back to back:
+ *
+ *      [ buffer          ][ mirror of buffer ]
+ *      ^                  ^
+ *      result             result + size
+ *
+ * So any `size` bytes starting in the first half are contiguous.
+ */
+char* BufferPool::allocateMirrored(std::size_t size)
+{
+    int fileId = ::memfd_create("ThorsAnvil::BufferPool", MFD_CLOEXEC);
+    if (fileId == -1)
+    {
+        throw std::runtime_error(buildErrorMessage("BufferPool::", __func__, ": memfd_create: ", strerror(errno)));
+    }
+    if (::ftruncate(fileId, size) != 0)
+    {
+        ::close(fileId);
+        throw std::runtime_error(buildErrorMessage("BufferPool::", __func__, ": ftruncate: ", strerror(errno)));
+    }
+
+    // Reserve the address space for both halves then map the file over each half.
+    void* reserve = ::mmap(nullptr, 2 * size, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (reserve == MAP_FAILED)
+    {
+        ::close(fileId);
+        throw std::runtime_error(buildErrorMessage("BufferPool::", __func__, ": mmap: ", strerror(errno)));
+    }
+    char*   base    = static_cast<char*>(reserve);
+    bool    mapped  = ::mmap(base,        size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fileId, 0) != MAP_FAILED
+                   && ::mmap(base + size, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fileId, 0) != MAP_FAILED;
+    int     error   = errno;
+
+    // The mappings keep the memory alive.
+    ::close(fileId);
+    if (!mapped)
+    {
+        ::munmap(base, 2 * size);
+        throw std::runtime_error(buildErrorMessage("BufferPool::", __func__, ": mmap: ", strerror(error)));
+    }
+    return base;
+}
+
+void BufferPool::freeMirrored(char* buffer, std::size_t size)
+{
+    ::munmap(buffer, 2 * size);
+}
+
+BufferPool& BufferPool::forThread()
+{
+    thread_local BufferPool     pool;
+    return pool;
+}
@@ -0,0 +1,125 @@
+
+#ifndef THORSANVIL_SOCKET_BUFFER_POOL_H
+#define THORSANVIL_SOCKET_BUFFER_POOL_H
+
+#include <vector>
+#include <cstddef>
+
+namespace ThorsAnvil
+{
+    namespace Socket
+    {
+
+// A free list of fixed size I/O buffers.
+//
+// Connections take a buffer when they are created and give it back
+// when they are destroyed. So at high connection churn the same (already
+// paged in) memory is reused rather than going through malloc/free.
+//
+// Each buffer is a ring buffer mirrored in virtual memory: the `size()`
+// bytes at data() are mapped a second time immediately after themselves.
+// So data that wraps around the end of the ring is still contiguous and
+// never needs to be moved. Building the mapping is expensive (memfd_create
+// plus mmap) which is another reason to reuse buffers. As mmap works with
+// whole pages the buffer size is rounded up to a multiple of the page size.
+//
+// Each thread has its own pool (see forThread()) so no locking is needed.
+// Note: A buffer must be returned on the thread that acquired it.
+//       This is the case for the EventLoop/WorkerPool servers where a
+//       connection never moves between threads.
+class BufferPool
+{
+    public:
+        struct Stats
+        {
+            std::size_t     hits;       // acquire() used a pooled buffer.
+            std::size_t     misses;     // acquire() had to allocate.
+            std::size_t     returns;    // Buffers put back in the pool.
+            std::size_t     discards;   // Buffers freed because the pool was full (or resized).
+        };
+
+        // Owns a buffer from the pool and gives it back on destruction.
+        class Buffer
+        {
+            BufferPool*     pool;
+            char*           buffer;
+            std::size_t     bufferSize;
+            public:
+                Buffer(BufferPool& pool, char* buffer, std::size_t bufferSize)
+                    : pool(&pool)
+                    , buffer(buffer)
+                    , bufferSize(bufferSize)
+                {}
+                ~Buffer();
+                Buffer(Buffer&& move) noexcept
+                    : pool(move.pool)
+                    , buffer(move.buffer)
+                    , bufferSize(move.bufferSize)
+                {
+                    move.buffer = nullptr;
+                }
+                Buffer& operator=(Buffer&& move) noexcept;
+                Buffer(Buffer const&)               = delete;
+                Buffer& operator=(Buffer const&)    = delete;
+
+                // data()[index] and data()[index + size()] are the same byte.
+                char*       data()                          {return buffer;}
+                char const* data() const                    {return buffer;}
+                std::size_t size() const                    {return bufferSize;}
+                char&       operator[](std::size_t index)   {return buffer[index];}
+        };
+
+        // Told about every buffer the pool maps and unmaps.
+        // The range passed is the whole mapping (both halves of the mirror).
+        // Used by the EventLoop to register the buffers with io_uring.
+        class Observer
+        {
+            public:
+                virtual ~Observer() {}
+                virtual void bufferCreated(char* buffer, std::size_t mappedSize)   = 0;
+                virtual void bufferDestroyed(char* buffer, std::size_t mappedSize) = 0;
+        };
+
+        static constexpr std::size_t defaultBufferSize  = 4096;
+        static constexpr std::size_t defaultMaxFree     = 1024;
+    private:
+        std::size_t         bufferSize;
+        std::size_t         maxFree;
+        std::vector<char*>  freeList;
+        Stats               stats;
+        Observer*           observer;
+
+        void release(char* buffer, std::size_t size);
+        char* create(std::size_t size);
+        void  destroy(char* buffer, std::size_t size);
+        static char* allocateMirrored(std::size_t size);
+        static void  freeMirrored(char* buffer, std::size_t size);
+    public:
+        BufferPool(std::size_t bufferSize = defaultBufferSize, std::size_t maxFree = defaultMaxFree);
+        ~BufferPool();
+        BufferPool(BufferPool const&)               = delete;
+        BufferPool& operator=(BufferPool const&)    = delete;
+
+        Buffer          acquire();
+
+        std::size_t     getBufferSize() const       {return bufferSize;}
+        Stats const&    getStats() const            {return stats;}
+
+        // Change the size of buffers handed out by acquire().
+        // Pooled buffers of the old size are freed (as are buffers
+        // of the old size that are still in use when they are returned).
+        void            setBufferSize(std::size_t size);
+
+        // Set (or clear with nullptr) the observer.
+        // The observer is told about the buffers currently in the pool.
+        // Buffers that are in use when it is set are never reported.
+        void            setObserver(Observer* observer);
+
+        // The pool for the current thread.
+        static BufferPool&  forThread();
+};
+
+    }
+}
+
+#endif
@@ -0,0 +1,111 @@
+
+#include "ConnectionPool.h"
+#include "Utility.h"
+#include <vector>
+
+using namespace ThorsAnvil::Socket;
+
+ConnectionPool::Connection::~Connection()
+{
+    if (pool != nullptr && socket && reusable)
+    {
+        pool->checkin(key, std::move(socket));
+    }
+}
+
+ConnectionPool::Connection::Connection(Connection&& move) noexcept
+    : pool(move.pool)
+    , key(std::move(move.key))
+    , socket(std::move(move.socket))
+    , reused(move.reused)
+    , reusable(move.reusable)
+{
+    move.reusable = false;
+}
+
+ConnectionPool::Connection& ConnectionPool::Connection::operator=(Connection&& move) noexcept
+{
+    using std::swap;
+    swap(pool,      move.pool);
+    swap(key,       move.key);
+    swap(socket,    move.socket);
+    swap(reused,    move.reused);
+    swap(reusable,  move.reusable);
+    return *this;
+}
+
+ConnectionPool::ConnectionPool(std::size_t maxIdle, Clock::duration idleTimeout)
+    : maxIdle(maxIdle)
+    , idleTimeout(idleTimeout)
+    , stats{0, 0, 0, 0, 0, 0}
+{}
+
+ConnectionPool::Connection ConnectionPool::checkout(std::string const& host, int port)
+{
+    std::string                                 key     = buildStringFromParts(host, ':', port);
+    // Dropped connections are closed after the lock is released.
+    std::vector<std::unique_ptr<DataSocket>>    dropped;
+    {
+        std::lock_guard<std::mutex>     lock(mutex);
+        std::deque<Idle>&               hostIdle    = idle[key];
+        Clock::time_point               oldest      = Clock::now() - idleTimeout;
+
+        // The front of the queue is the oldest.
+        while(!hostIdle.empty() && hostIdle.front().returned < oldest)
+        {
+            ++stats.expired;
+            dropped.emplace_back(std::move(hostIdle.front().socket));
+            hostIdle.pop_front();
+        }
+        // Take the most recently used (least likely to have been closed by the server).
+        while(!hostIdle.empty())
+        {
+            std::unique_ptr<DataSocket> socket = std::move(hostIdle.back().socket);
+            hostIdle.pop_back();
+            if (socket->isIdle())
+            {
+                ++stats.reused;
+                return Connection(*this, std::move(key), std::move(socket), true);
+            }
+            ++stats.unhealthy;
+            dropped.emplace_back(std::move(socket));
+        }
+        ++stats.created;
+    }
+    // Connect without holding the lock.
+    return Connection(*this, std::move(key), std::make_unique<ConnectSocket>(host, port), false);
+}
+
+void ConnectionPool::checkin(std::string const& key, std::unique_ptr<DataSocket>&& socket)
+{
+    std::unique_ptr<DataSocket>     dropped;
+    if (!socket->isIdle())
+    {
+        std::lock_guard<std::mutex>     lock(mutex);
+        ++stats.unhealthy;
+        return;
+    }
+
+    std::lock_guard<std::mutex>     lock(mutex);
+    std::deque<Idle>&               hostIdle    = idle[key];
+    if (hostIdle.size() == maxIdle)
+    {
+        if (maxIdle == 0)
+        {
+            ++stats.discards;
+            return;
+        }
+        // Keep the most recent connections.
+        ++stats.discards;
+        dropped = std::move(hostIdle.front().socket);
+        hostIdle.pop_front();
+    }
+    ++stats.returns;
+    hostIdle.push_back(Idle{std::move(socket), Clock::now()});
+}
+
+ConnectionPool::Stats ConnectionPool::getStats()
+{
+    std::lock_guard<std::mutex>     lock(mutex);
+    return stats;
+}
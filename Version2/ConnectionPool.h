@@ -0,0 +1,115 @@
+
+#ifndef THORSANVIL_SOCKET_CONNECTION_POOL_H
+#define THORSANVIL_SOCKET_CONNECTION_POOL_H
+
+#include "Socket.h"
+#include <map>
+#include <deque>
+#include <mutex>
+#include <memory>
+#include <string>
+#include <chrono>
+#include <cstddef>
+
+namespace ThorsAnvil
+{
+    namespace Socket
+    {
+
+// A pool of open client connections keyed by "host:port".
+//
+// Opening a TCP connection costs a round trip (plus the server's accept)
+// before any data is sent. When the same few servers are called over and
+// over the connections are borrowed from the pool and put back when the
+// exchange is complete so the handshake is only paid once.
+//
+// A connection is only put back if the user marks it as reusable (ie the
+// exchange completed and the server did not ask for it to be closed).
+// Pooled connections are checked when they are returned and again when
+// they are borrowed: a connection the server has closed (or that has
+// unread data) is dropped.
+//
+// Thread safe: Any thread can borrow from or return to the pool.
+class ConnectionPool
+{
+    public:
+        using Clock     = std::chrono::steady_clock;
+
+        struct Stats
+        {
+            std::size_t     created;    // New connections opened by checkout().
+            std::size_t     reused;     // checkout() used a pooled connection.
+            std::size_t     returns;    // Connections put back in the pool.
+            std::size_t     expired;    // Dropped after being idle too long.
+            std::size_t     unhealthy;  // Dropped because they were closed (or had unread data).
+            std::size_t     discards;   // Dropped because the pool for the host was full.
+        };
+
+        // A borrowed connection.
+        // Returned to the pool on destruction if setReusable(true) was called.
+        class Connection
+        {
+            ConnectionPool*             pool;
+            std::string                 key;
+            std::unique_ptr<DataSocket> socket;
+            bool                        reused;
+            bool                        reusable;
+            public:
+                Connection()
+                    : pool(nullptr)
+                    , reused(false)
+                    , reusable(false)
+                {}
+                Connection(ConnectionPool& pool, std::string key, std::unique_ptr<DataSocket>&& socket, bool reused)
+                    : pool(&pool)
+                    , key(std::move(key))
+                    , socket(std::move(socket))
+                    , reused(reused)
+                    , reusable(false)
+                {}
+                ~Connection();
+                Connection(Connection&& move) noexcept;
+                Connection& operator=(Connection&& move) noexcept;
+                Connection(Connection const&)               = delete;
+                Connection& operator=(Connection const&)    = delete;
+
+                DataSocket& getSocket()                 {return *socket;}
+                // True if this connection came from the pool (rather than being opened).
+                bool        isReused() const            {return reused;}
+                void        setReusable(bool value)     {reusable = value;}
+        };
+
+        static constexpr std::size_t    defaultMaxIdle      = 8;
+        static constexpr int            defaultIdleTimeout  = 30;      // seconds
+    private:
+        struct Idle
+        {
+            std::unique_ptr<DataSocket> socket;
+            Clock::time_point           returned;
+        };
+
+        std::size_t                                 maxIdle;
+        Clock::duration                             idleTimeout;
+        std::mutex                                  mutex;
+        std::map<std::string, std::deque<Idle>>     idle;
+        Stats                                       stats;
+
+        void checkin(std::string const& key, std::unique_ptr<DataSocket>&& socket);
+    public:
+        // Keep at most `maxIdle` connections per host.
+        // Connections idle for longer than `idleTimeout` are not reused.
+        ConnectionPool(std::size_t maxIdle = defaultMaxIdle, Clock::duration idleTimeout = std::chrono::seconds(defaultIdleTimeout));
+        ConnectionPool(ConnectionPool const&)               = delete;
+        ConnectionPool& operator=(ConnectionPool const&)    = delete;
+
+        // Borrow a connection to host:port.
+        // Uses the most recently returned idle connection or opens a new one.
+        Connection  checkout(std::string const& host, int port);
+
+        Stats       getStats();
+};
+
+    }
+}
+
+#endif
@@ -0,0 +1,663 @@
+
+#include "EventLoop.h"
+#include "Socket.h"
+#include "URing.h"
+#include "Utility.h"
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/resource.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+#include <iostream>
+
+using namespace ThorsAnvil::Socket;
+
+thread_local EventLoop::Task*   EventLoop::currentTask = nullptr;
+
+EventLoop::Task::Task(EventLoop& loop, BaseSocket& socket, std::unique_ptr<DataSocket>&& owned, std::function<void()>&& action)
+    : loop(loop)
+    , socket(socket)
+    , owned(std::move(owned))
+    , action(std::move(action))
+    , stack(new char[stackSize])
+    , waitingFor(EPOLLIN)
+    , done(false)
+    , index(0)
+    , result(0)
+    , acceptArmed(false)
+    , acceptWaiting(false)
+{
+    if (::getcontext(&context) != 0)
+    {
+        throw std::runtime_error(buildErrorMessage("EventLoop::Task::", __func__, ": getcontext: ", strerror(errno)));
+    }
+    context.uc_stack.ss_sp      = stack.get();
+    context.uc_stack.ss_size    = stackSize;
+    context.uc_link             = &loop.loopContext;
+
+    // makecontext() only passes int arguments.
+    // So split the pointer to this object across two of them.
+    std::uint64_t   self    = reinterpret_cast<std::uintptr_t>(this);
+    ::makecontext(&context, reinterpret_cast<void(*)()>(&EventLoop::taskEntry), 2,
+                  static_cast<unsigned int>(self >> 32),
+                  static_cast<unsigned int>(self & 0xFFFFFFFF));
+}
+
+EventLoop::EventLoop(Backend backendRequested)
+    : backend(backendRequested)
+    , epollId(-1)
+    , finished(false)
+    , fileSlots(0)
+    , observedPool(nullptr)
+{
+    if (backend == Backend::Best && URing::isSupported())
+    {
+        try
+        {
+            backend = Backend::URing;
+            ringSetup();
+            return;
+        }
+        catch(std::exception const&)
+        {
+            // eg RLIMIT_MEMLOCK is too small for the ring.
+            // Best falls back to epoll rather than failing.
+            ring.reset();
+            fileSlots = 0;
+            freeBufferSlots.clear();
+            backend = Backend::Epoll;
+        }
+    }
+    if (backend != Backend::URing)
+    {
+        backend = Backend::Epoll;
+        epollId = ::epoll_create1(EPOLL_CLOEXEC);
+        if (epollId == -1)
+        {
+            throw std::runtime_error(buildErrorMessage("EventLoop::", __func__, ": epoll_create1: ", strerror(errno)));
+        }
+        return;
+    }
+    ringSetup();
+}
+
+void EventLoop::ringSetup()
+{
+    ring.reset(new URing(ringEntries));
+
+    // The size of the fixed file table is limited by RLIMIT_NOFILE.
+    // Sockets that don't get a slot are simply used by their fd.
+    rlimit  limit;
+    fileSlots = maxFiles;
+    if (::getrlimit(RLIMIT_NOFILE, &limit) == 0 && limit.rlim_cur < fileSlots)
+    {
+        fileSlots = limit.rlim_cur;
+    }
+    ring->registerFiles(fileSlots);
+    ring->registerBuffers(maxBuffers);
+    for(unsigned slot = maxBuffers; slot != 0; --slot)
+    {
+        freeBufferSlots.push_back(slot - 1);
+    }
+}
+
+EventLoop::~EventLoop()
+{
+    if (observedPool != nullptr)
+    {
+        observedPool->setObserver(nullptr);
+    }
+    // Closing the ring cancels any outstanding requests.
+    // So it must go before the tasks they refer to.
+    ring.reset();
+    for(auto& task: tasks)
+    {
+        // The listening sockets outlive the loop.
+        task.second->socket.socketIO = nullptr;
+    }
+
+    // Note: Any task that is still suspended is simply dropped.
+    //       Objects on its stack are not destroyed (but the socket is closed).
+    tasks.clear();
+    if (epollId != -1)
+    {
+        ::close(epollId);
+    }
+}
+
+void EventLoop::listen(ServerSocket& server, Handler handler)
+{
+    addTask(server, nullptr, [this, &server, handler]()
+    {
+        std::vector<DataSocket>     accepted;
+        while(!finished)
+        {
+            // For epoll accepted non-blocking so the task does not need to change them.
+            // io_uring sockets stay blocking (see addTask()).
+            int     flags = backend == Backend::Epoll ? SOCK_NONBLOCK : 0;
+            accepted.emplace_back(server.accept(flags));
+            if (backend == Backend::Epoll)
+            {
+                // Take every other connection already queued in this wakeup.
+                // (io_uring's multishot accept collects them in the task).
+                server.acceptPending(accepted, maxAcceptBatch - 1, flags);
+            }
+            for(auto& accept: accepted)
+            {
+                std::unique_ptr<DataSocket> connection(new DataSocket(std::move(accept)));
+                DataSocket&                 socket = *connection;
+                addTask(socket, std::move(connection), [handler, &socket](){handler(socket);});
+            }
+            accepted.clear();
+        }
+    });
+}
+
+void EventLoop::run()
+{
+    finished = false;
+    if (backend == Backend::Epoll)
+    {
+        runEpoll();
+    }
+    else
+    {
+        runURing();
+    }
+}
+
+void EventLoop::runEpoll()
+{
+    epoll_event     events[maxEvents];
+    while(!finished)
+    {
+        // Wait no longer than the next paused task wants to sleep.
+        int timeout = -1;
+        if (!sleeping.empty())
+        {
+            auto wait   = std::chrono::ceil<std::chrono::milliseconds>(sleeping.begin()->first - Clock::now());
+            timeout     = std::max(wait.count(), static_cast<decltype(wait.count())>(0));
+        }
+        int count = ::epoll_wait(epollId, events, maxEvents, timeout);
+        if (count == -1)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            throw std::runtime_error(buildErrorMessage("EventLoop::", __func__, ": epoll_wait: ", strerror(errno)));
+        }
+        for(int loop = 0; loop < count; ++loop)
+        {
+            resume(*static_cast<Task*>(events[loop].data.ptr));
+        }
+        wakeSleeping();
+    }
+}
+
+void EventLoop::wakeSleeping()
+{
+    Clock::time_point   now = Clock::now();
+    while(!sleeping.empty() && sleeping.begin()->first <= now)
+    {
+        Task& task = *sleeping.begin()->second;
+        sleeping.erase(sleeping.begin());
+        resume(task);
+    }
+}
+
+void EventLoop::stop()
+{
+    finished = true;
+}
+
+void EventLoop::addTask(BaseSocket& socket, std::unique_ptr<DataSocket>&& owned, std::function<void()>&& action)
+{
+    std::unique_ptr<Task>   task(new Task(*this, socket, std::move(owned), std::move(action)));
+    Task&                   taskRef = *task;
+
+    if (backend == Backend::URing)
+    {
+        // The socket is left blocking: the ring waits for it to be ready
+        // (a non-blocking socket would make each idle read EAGAIN then poll then read).
+        socket.readYield    = [this, &taskRef](){yield(taskRef, EPOLLIN);};
+        socket.writeYield   = [this, &taskRef](){yield(taskRef, EPOLLOUT);};
+
+        if (freeTaskIndex.empty())
+        {
+            taskRef.index = ringTasks.size();
+            ringTasks.emplace_back(nullptr);
+        }
+        else
+        {
+            taskRef.index = freeTaskIndex.back();
+            freeTaskIndex.pop_back();
+        }
+        ringTasks[taskRef.index] = &taskRef;
+        if (taskRef.index < fileSlots)
+        {
+            ring->updateFile(taskRef.index, socket.getSocketId());
+        }
+        socket.socketIO = &taskRef;
+
+        // Start the task on the next pass of the loop.
+        // Its first read is then queued with all the other requests.
+        ringRequest(taskRef, socket.getSocketId(), IORING_OP_NOP);
+        tasks.emplace(socket.getSocketId(), std::move(task));
+        return;
+    }
+
+    socket.setNonBlocking([this, &taskRef](){yield(taskRef, EPOLLIN);},
+                          [this, &taskRef](){yield(taskRef, EPOLLOUT);});
+
+    // The task is not started until there is data available.
+    epoll_event     event{};
+    event.events    = taskRef.waitingFor;
+    event.data.ptr  = &taskRef;
+    if (::epoll_ctl(epollId, EPOLL_CTL_ADD, socket.getSocketId(), &event) != 0)
+    {
+        throw std::runtime_error(buildErrorMessage("EventLoop::", __func__, ": epoll_ctl: ", strerror(errno)));
+    }
+    tasks.emplace(socket.getSocketId(), std::move(task));
+}
+
+void EventLoop::removeTask(Task& task)
+{
+    int socketId = task.socket.getSocketId();
+    if (backend == Backend::URing)
+    {
+        // The fixed file table holds a reference to the socket.
+        // So it must be cleared for the close to take effect.
+        if (task.index < fileSlots)
+        {
+            ring->updateFile(task.index, -1);
+        }
+        ringTasks[task.index] = nullptr;
+        task.socket.socketIO  = nullptr;
+        if (task.acceptArmed)
+        {
+            // The cancelled accept will still complete (with an error).
+            // So the index is retired rather than reused; the completion
+            // finds a null task and is dropped.
+            io_uring_sqe&   cancel  = ring->getSqe();
+            cancel.opcode           = IORING_OP_ASYNC_CANCEL;
+            cancel.user_data        = ignoreUserData;
+            cancel.addr             = (static_cast<std::uint64_t>(task.index) << 1) | 1;
+        }
+        else
+        {
+            freeTaskIndex.push_back(task.index);
+        }
+    }
+    else
+    {
+        ::epoll_ctl(epollId, EPOLL_CTL_DEL, socketId, nullptr);
+    }
+    // Destroys the task and closes the socket it owns.
+    tasks.erase(socketId);
+}
+
+void EventLoop::resume(Task& task)
+{
+    currentTask = &task;
+    int result  = ::swapcontext(&loopContext, &task.context);
+    currentTask = nullptr;
+    if (result != 0)
+    {
+        throw std::runtime_error(buildErrorMessage("EventLoop::", __func__, ": swapcontext: ", strerror(errno)));
+    }
+    if (task.done)
+    {
+        removeTask(task);
+    }
+}
+
+void EventLoop::yield(Task& task, std::uint32_t event)
+{
+    if (backend == Backend::URing)
+    {
+        // Ring sockets are blocking so this is only reached if a request
+        // still returns EAGAIN (eg a socket that was already non-blocking).
+        io_uring_sqe&   poll    = ringRequest(task, task.socket.getSocketId(), IORING_OP_POLL_ADD);
+        poll.poll32_events      = event;
+        ringWait(task);
+        return;
+    }
+    if (task.waitingFor != event)
+    {
+        epoll_event     change{};
+        change.events   = event;
+        change.data.ptr = &task;
+        if (::epoll_ctl(epollId, EPOLL_CTL_MOD, task.socket.getSocketId(), &change) != 0)
+        {
+            throw std::runtime_error(buildErrorMessage("EventLoop::", __func__, ": epoll_ctl: ", strerror(errno)));
+        }
+        task.waitingFor = event;
+    }
+    // Return control to the loop.
+    // We come back here when epoll says the socket is ready.
+    suspend(task);
+}
+
+void EventLoop::suspend(Task& task)
+{
+    ::swapcontext(&task.context, &loopContext);
+}
+
+bool EventLoop::pause(Clock::duration time)
+{
+    Task* task = currentTask;
+    if (task == nullptr)
+    {
+        return false;
+    }
+    task->loop.pauseTask(*task, time);
+    return true;
+}
+
+void EventLoop::pauseTask(Task& task, Clock::duration time)
+{
+    if (backend == Backend::URing)
+    {
+        // On the task's stack which is kept until the request completes.
+        auto                seconds = std::chrono::duration_cast<std::chrono::seconds>(time);
+        __kernel_timespec   wait{seconds.count(), std::chrono::duration_cast<std::chrono::nanoseconds>(time - seconds).count()};
+        io_uring_sqe&       request = ring->getSqe();
+        request.opcode              = IORING_OP_TIMEOUT;
+        request.user_data           = static_cast<std::uint64_t>(task.index) << 1;
+        request.addr                = reinterpret_cast<std::uintptr_t>(&wait);
+        request.len                 = 1;
+        // Completes with ETIME.
+        ringWait(task);
+        return;
+    }
+
+    // The socket is taken out of epoll while the task sleeps.
+    // Otherwise its events (ie a pipelined request) would resume it early.
+    int socketId = task.socket.getSocketId();
+    ::epoll_ctl(epollId, EPOLL_CTL_DEL, socketId, nullptr);
+    sleeping.emplace(Clock::now() + time, &task);
+    suspend(task);
+
+    epoll_event     event{};
+    event.events    = task.waitingFor;
+    event.data.ptr  = &task;
+    if (::epoll_ctl(epollId, EPOLL_CTL_ADD, socketId, &event) != 0)
+    {
+        throw std::runtime_error(buildErrorMessage("EventLoop::", __func__, ": epoll_ctl: ", strerror(errno)));
+    }
+}
+
+void EventLoop::taskEntry(unsigned int high, unsigned int low)
+{
+    Task& task = *reinterpret_cast<Task*>(static_cast<std::uintptr_t>((static_cast<std::uint64_t>(high) << 32) | low));
+    try
+    {
+        task.action();
+    }
+    catch(std::exception const& e)
+    {
+        // Exceptions can not propagate out of the task's stack.
+        // TODO: LOGGING CODE HERE
+        std::cerr << "EventLoop: connection dropped: " << e.what() << "\n";
+    }
+    catch(...)
+    {
+        std::cerr << "EventLoop: connection dropped: unknown exception\n";
+    }
+    task.done = true;
+    // Returning switches back to the loop via `uc_link`.
+}
+
+/*
+ * URing backend.
+ *
+ * Every request carries the task index in `user_data` (shifted left one
+ * bit, the bottom bit marks a multishot accept). An index rather than a
+ * pointer so that a late completion for a removed task can be detected.
+ */
+void EventLoop::runURing()
+{
+    if (observedPool == nullptr)
+    {
+        // The pool is per thread so this must be done on the thread running the loop.
+        observedPool = &BufferPool::forThread();
+        observedPool->setObserver(this);
+    }
+    while(!finished)
+    {
+        // Submit everything queued since the last pass and wait for a completion.
+        ring->submit(1);
+        ring->processCompletions([this](io_uring_cqe const& cqe){ringComplete(cqe);});
+    }
+}
+
+void EventLoop::ringComplete(io_uring_cqe const& cqe)
+{
+    if (cqe.user_data == ignoreUserData)
+    {
+        return;
+    }
+    Task* task = ringTasks[cqe.user_data >> 1];
+    if (task == nullptr)
+    {
+        return;
+    }
+    if ((cqe.user_data & 1) == 0)
+    {
+        task->result = cqe.res;
+        resume(*task);
+        return;
+    }
+
+    // Multishot accept: Each connection is a separate completion.
+    task->accepted.emplace_back(cqe.res);
+    if ((cqe.flags & IORING_CQE_F_MORE) == 0)
+    {
+        // The kernel has stopped this accept (it is re-armed on the next call).
+        task->acceptArmed = false;
+    }
+    if (task->acceptWaiting)
+    {
+        task->acceptWaiting = false;
+        resume(*task);
+    }
+}
+
+io_uring_sqe& EventLoop::ringRequest(Task& task, int socketId, unsigned char opcode, bool accept)
+{
+    io_uring_sqe&   request = ring->getSqe();
+    request.opcode          = opcode;
+    request.user_data       = (static_cast<std::uint64_t>(task.index) << 1) | (accept ? 1 : 0);
+    if (task.index < fileSlots)
+    {
+        request.fd          = task.index;
+        request.flags       = IOSQE_FIXED_FILE;
+    }
+    else
+    {
+        request.fd          = socketId;
+    }
+    return request;
+}
+
+ssize_t EventLoop::ringWait(Task& task)
+{
+    suspend(task);
+    if (task.result < 0)
+    {
+        errno = -task.result;
+        return -1;
+    }
+    return task.result;
+}
+
+bool EventLoop::ringFindBuffer(char* buffer, std::size_t size, unsigned& slot) const
+{
+    auto find = buffers.upper_bound(buffer);
+    if (find == buffers.begin())
+    {
+        return false;
+    }
+    --find;
+    if (buffer + size > find->first + find->second.size)
+    {
+        return false;
+    }
+    slot = find->second.slot;
+    return true;
+}
+
+void EventLoop::bufferCreated(char* buffer, std::size_t mappedSize)
+{
+    if (freeBufferSlots.empty())
+    {
+        // Reads into this buffer use IORING_OP_RECV.
+        return;
+    }
+    unsigned slot = freeBufferSlots.back();
+    try
+    {
+        ring->updateBuffer(slot, buffer, mappedSize);
+    }
+    catch(std::exception const&)
+    {
+        // Registering pins the memory (RLIMIT_MEMLOCK).
+        // Not fatal: reads into this buffer use IORING_OP_RECV.
+        return;
+    }
+    freeBufferSlots.pop_back();
+    buffers.emplace(buffer, RegisteredBuffer{slot, mappedSize});
+}
+
+void EventLoop::bufferDestroyed(char* buffer, std::size_t)
+{
+    auto find = buffers.find(buffer);
+    if (find == buffers.end())
+    {
+        return;
+    }
+    ring->updateBuffer(find->second.slot, nullptr, 0);
+    freeBufferSlots.push_back(find->second.slot);
+    buffers.erase(find);
+}
+
+ssize_t EventLoop::Task::read(int socketId, char* buffer, std::size_t size)
+{
+    unsigned        slot;
+    bool            fixed   = loop.ringFindBuffer(buffer, size, slot);
+    io_uring_sqe&   request = loop.ringRequest(*this, socketId, fixed ? IORING_OP_READ_FIXED : IORING_OP_RECV);
+    request.addr            = reinterpret_cast<std::uintptr_t>(buffer);
+    request.len             = size;
+    if (fixed)
+    {
+        request.buf_index   = slot;
+        request.off         = -1;
+    }
+    return loop.ringWait(*this);
+}
+
+ssize_t EventLoop::Task::write(int socketId, char const* buffer, std::size_t size)
+{
+    io_uring_sqe&   request = loop.ringRequest(*this, socketId, IORING_OP_SEND);
+    request.addr            = reinterpret_cast<std::uintptr_t>(buffer);
+    request.len             = size;
+    return loop.ringWait(*this);
+}
+
+ssize_t EventLoop::Task::writev(int socketId, struct iovec const* data, int count, int flags)
+{
+    if (flags == 0)
+    {
+        io_uring_sqe&   request = loop.ringRequest(*this, socketId, IORING_OP_WRITEV);
+        request.addr            = reinterpret_cast<std::uintptr_t>(data);
+        request.len             = count;
+        request.off             = -1;
+        return loop.ringWait(*this);
+    }
+    // writev has no flags (MSG_MORE).
+    // Note: `message` is on this task's stack which is kept until the request completes.
+    msghdr          message{};
+    message.msg_iov         = const_cast<iovec*>(data);
+    message.msg_iovlen      = count;
+    io_uring_sqe&   request = loop.ringRequest(*this, socketId, IORING_OP_SENDMSG);
+    request.addr            = reinterpret_cast<std::uintptr_t>(&message);
+    request.len             = 1;
+    request.msg_flags       = flags;
+    return loop.ringWait(*this);
+}
+
+/*
+ * io_uring has no sendfile.
+ * So a block of the file is read (from the page cache) into a buffer
+ * and sent. Both are ring requests so the task never blocks the loop.
+ */
+ssize_t EventLoop::Task::sendfile(int socketId, int fileId, off_t* offset, std::size_t size)
+{
+    if (!fileBuffer)
+    {
+        fileBuffer.reset(new char[fileBufferSize]);
+    }
+    std::size_t     block   = std::min(size, fileBufferSize);
+    io_uring_sqe&   read    = loop.ring->getSqe();
+    read.opcode             = IORING_OP_READ;
+    read.user_data          = static_cast<std::uint64_t>(index) << 1;
+    read.fd                 = fileId;
+    read.addr               = reinterpret_cast<std::uintptr_t>(fileBuffer.get());
+    read.len                = block;
+    read.off                = *offset;
+    ssize_t         got     = loop.ringWait(*this);
+    if (got <= 0)
+    {
+        return got;
+    }
+
+    ssize_t         sent    = 0;
+    while(sent < got)
+    {
+        io_uring_sqe&   request = loop.ringRequest(*this, socketId, IORING_OP_SEND);
+        request.addr            = reinterpret_cast<std::uintptr_t>(fileBuffer.get() + sent);
+        request.len             = got - sent;
+        // More of the file follows this block.
+        request.msg_flags       = block < size ? MSG_MORE : 0;
+        ssize_t         put     = loop.ringWait(*this);
+        if (put < 0)
+        {
+            if (sent == 0)
+            {
+                return -1;
+            }
+            break;
+        }
+        sent += put;
+    }
+    *offset += sent;
+    return sent;
+}
+
+int EventLoop::Task::accept(int socketId, int flags)
+{
+    while(accepted.empty())
+    {
+        if (!acceptArmed)
+        {
+            io_uring_sqe&   request = loop.ringRequest(*this, socketId, IORING_OP_ACCEPT, true);
+            request.ioprio          = IORING_ACCEPT_MULTISHOT;
+            request.accept_flags    = flags | SOCK_CLOEXEC;
+            acceptArmed             = true;
+        }
+        acceptWaiting = true;
+        loop.suspend(*this);
+    }
+    int result = accepted.front();
+    accepted.pop_front();
+    if (result < 0)
+    {
+        errno = -result;
+        return -1;
+    }
+    return result;
+}
@@ -0,0 +1,164 @@
+
+#ifndef THORSANVIL_SOCKET_EVENT_LOOP_H
+#define THORSANVIL_SOCKET_EVENT_LOOP_H
+
+#include "Socket.h"
+#include "BufferPool.h"
+#include <map>
+#include <deque>
+#include <vector>
+#include <memory>
+#include <functional>
+#include <chrono>
+#include <cstdint>
+#include <ucontext.h>
+
+struct io_uring_sqe;
+struct io_uring_cqe;
+
+namespace ThorsAnvil
+{
+    namespace Socket
+    {
+
+class URing;
+
+// A single threaded reactor built on epoll.
+//
+// Each connection is handled by a normal (blocking style) function.
+// But the function runs on its own stack and the socket is put in
+// non-blocking mode. When a read or write would block the socket
+// yields back to the event loop which can then service other
+// connections. When epoll reports the socket is ready again the
+// function is resumed exactly where it left off.
+//
+// This means the existing Protocol classes can be used unchanged.
+//
+// The loop has two backends:
+//  Epoll:  The socket makes the system calls itself. On EAGAIN the task
+//          waits for epoll to say the socket is ready and then retries.
+//  URing:  The socket's system calls are replaced (see SocketIO) by
+//          io_uring requests. The task waits for the request to complete.
+//          All the requests queued by one pass of the loop (across all
+//          connections) are submitted with a single io_uring_enter()
+//          which also collects the completions. The listener uses a
+//          multishot accept, sockets are registered as fixed files and
+//          the BufferPool buffers are registered so reads into them use
+//          IORING_OP_READ_FIXED.
+class EventLoop: private BufferPool::Observer
+{
+    public:
+        using Handler = std::function<void(DataSocket&)>;
+        using Clock   = std::chrono::steady_clock;
+        enum class Backend {Epoll, URing, Best};
+    private:
+        static constexpr std::size_t stackSize      = 128 * 1024;
+        static constexpr int         maxEvents      = 256;
+        static constexpr std::size_t maxAcceptBatch = 64;     // Connections accepted per wakeup of a listener.
+        static constexpr unsigned    ringEntries    = 256;
+        static constexpr unsigned    maxFiles       = 4096;
+        static constexpr unsigned    maxBuffers     = BufferPool::defaultMaxFree;
+        static constexpr std::size_t fileBufferSize = 64 * 1024;
+        // The user_data of requests whose completion is ignored (cancels).
+        static constexpr std::uint64_t ignoreUserData = ~static_cast<std::uint64_t>(0);
+
+        struct Task: public SocketIO
+        {
+            EventLoop&                  loop;
+            BaseSocket&                 socket;
+            std::unique_ptr<DataSocket> owned;
+            std::function<void()>       action;
+            std::unique_ptr<char[]>     stack;
+            ucontext_t                  context;
+            std::uint32_t               waitingFor;
+            bool                        done;
+
+            // URing backend
+            unsigned                    index;          // Position in `ringTasks` (and the fixed file slot).
+            int                         result;         // Result of the last completed request.
+            bool                        acceptArmed;    // A multishot accept is active.
+            bool                        acceptWaiting;  // Suspended in accept().
+            std::deque<int>             accepted;       // Completed accepts not yet collected.
+            std::unique_ptr<char[]>     fileBuffer;     // sendfile(): allocated on first use.
+
+            Task(EventLoop& loop, BaseSocket& socket, std::unique_ptr<DataSocket>&& owned, std::function<void()>&& action);
+
+            virtual ssize_t read(int socketId, char* buffer, std::size_t size) override;
+            virtual ssize_t write(int socketId, char const* buffer, std::size_t size) override;
+            virtual ssize_t writev(int socketId, struct iovec const* data, int count, int flags) override;
+            virtual int     accept(int socketId, int flags) override;
+            virtual ssize_t sendfile(int socketId, int fileId, off_t* offset, std::size_t size) override;
+        };
+        // The task running on this thread (nullptr in the loop itself).
+        static thread_local Task*       currentTask;
+
+        struct RegisteredBuffer
+        {
+            unsigned        slot;
+            std::size_t     size;
+        };
+
+        Backend                         backend;
+        int                             epollId;
+        bool                            finished;
+        ucontext_t                      loopContext;
+        std::map<int, std::unique_ptr<Task>>  tasks;
+        // Epoll backend: Tasks in pause() by the time they wake.
+        std::multimap<Clock::time_point, Task*>   sleeping;
+
+        // URing backend
+        std::unique_ptr<URing>          ring;
+        unsigned                        fileSlots;
+        std::vector<Task*>              ringTasks;
+        std::vector<unsigned>           freeTaskIndex;
+        std::map<char*, RegisteredBuffer>   buffers;
+        std::vector<unsigned>           freeBufferSlots;
+        BufferPool*                     observedPool;
+
+        static void taskEntry(unsigned int high, unsigned int low);
+        void addTask(BaseSocket& socket, std::unique_ptr<DataSocket>&& owned, std::function<void()>&& action);
+        void removeTask(Task& task);
+        void resume(Task& task);
+        void yield(Task& task, std::uint32_t event);
+        void suspend(Task& task);
+        void pauseTask(Task& task, Clock::duration time);
+        void wakeSleeping();
+
+        void          runEpoll();
+        void          runURing();
+        void          ringSetup();
+        void          ringComplete(io_uring_cqe const& cqe);
+        io_uring_sqe& ringRequest(Task& task, int socketId, unsigned char opcode, bool accept = false);
+        ssize_t       ringWait(Task& task);
+        bool          ringFindBuffer(char* buffer, std::size_t size, unsigned& slot) const;
+
+        virtual void bufferCreated(char* buffer, std::size_t mappedSize) override;
+        virtual void bufferDestroyed(char* buffer, std::size_t mappedSize) override;
+    public:
+        // Best uses io_uring when the kernel supports it and falls back to epoll.
+        EventLoop(Backend backend = Backend::Best);
+        ~EventLoop();
+        EventLoop(EventLoop const&)             = delete;
+        EventLoop& operator=(EventLoop const&)  = delete;
+
+        Backend getBackend() const {return backend;}
+
+        // Accept connections on `server`.
+        // Each new connection is passed to `handler` when it first has data.
+        // Note: `server` must outlive the event loop.
+        void listen(ServerSocket& server, Handler handler);
+
+        // Run until stop() is called.
+        void run();
+        void stop();
+
+        // Suspend the calling task for `time` while the loop runs the other tasks.
+        // For waiting on something that is not a socket (ie another thread).
+        // Returns false (without waiting) if not called from an EventLoop task.
+        static bool pause(Clock::duration time);
+};
+
+    }
+}
+
+#endif
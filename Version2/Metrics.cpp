@@ -0,0 +1,168 @@
+
+#include "Metrics.h"
+#include "Utility.h"
+#include <mutex>
+#include <vector>
+#include <algorithm>
+
+using namespace ThorsAnvil::Socket;
+
+namespace
+{
+    struct Registry
+    {
+        std::mutex                  mutex;
+        std::vector<void const*>    live;
+        Metrics::Snapshot           retired{};
+    };
+    Registry& registry()
+    {
+        // Never destroyed: threads may exit after main() returns.
+        static Registry* registry = new Registry;
+        return *registry;
+    }
+
+    struct Description
+    {
+        char const*     name;
+        char const*     type;
+        char const*     help;
+    };
+    // Indexed by Metrics::Counter.
+    // The exceptions share one metric with a label (see prometheus()).
+    Description const counterDescription[] =
+    {
+        {"thors_connections_accepted_total",    "counter",  "Connections accepted."},
+        {"thors_connections_opened_total",      "counter",  "Connections served by an HTTPServer."},
+        {"thors_connections_closed_total",      "counter",  "Connections an HTTPServer has finished with."},
+        {"thors_requests_total",                "counter",  "Requests read."},
+        {"thors_bytes_received_total",          "counter",  "Bytes read from sockets."},
+        {"thors_bytes_sent_total",              "counter",  "Bytes written to sockets."},
+        {"thors_syscalls_total",                "counter",  "Socket read/write/writev/accept/sendfile calls."},
+        {"thors_parse_errors_total",            "counter",  "Requests with an invalid start line or headers."},
+    };
+    // Indexed by Metrics::Latency.
+    Description const latencyDescription[] =
+    {
+        {"thors_first_byte_seconds",            "histogram", "Time from accepting a connection to the first byte of its first request."},
+        {"thors_parse_seconds",                 "histogram", "Time from the first byte of a request to the whole request being read."},
+        {"thors_send_seconds",                  "histogram", "Time taken to send a response."},
+    };
+}
+
+class Metrics::ThreadBlock
+{
+    public:
+        Block   block{};
+        ThreadBlock()
+        {
+            Registry&                   all = registry();
+            std::lock_guard<std::mutex> lock(all.mutex);
+            all.live.emplace_back(&block);
+        }
+        ~ThreadBlock()
+        {
+            // Keep what this thread recorded.
+            Registry&                   all = registry();
+            std::lock_guard<std::mutex> lock(all.mutex);
+            addTo(all.retired, block);
+            all.live.erase(std::find(std::begin(all.live), std::end(all.live), &block));
+        }
+        static void addTo(Snapshot& total, Block const& block)
+        {
+            for(std::size_t counter = 0; counter < CounterCount; ++counter)
+            {
+                total.counters[counter] += block.counters[counter].load(std::memory_order_relaxed);
+            }
+            for(std::size_t latency = 0; latency < LatencyCount; ++latency)
+            {
+                for(std::size_t bucket = 0; bucket <= bucketCount; ++bucket)
+                {
+                    total.buckets[latency][bucket] += block.buckets[latency][bucket].load(std::memory_order_relaxed);
+                }
+                total.sum[latency] += block.sum[latency].load(std::memory_order_relaxed);
+            }
+        }
+};
+
+Metrics::Block& Metrics::local()
+{
+    thread_local ThreadBlock    threadBlock;
+    return threadBlock.block;
+}
+
+void Metrics::time(Latency latency, std::chrono::steady_clock::duration elapsed)
+{
+    std::uint64_t   nano    = std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count();
+    // Bucket n holds values up to 2^n micro seconds.
+    std::uint64_t   micro   = (nano + 999) / 1000;
+    std::size_t     bucket  = micro <= 1 ? 0 : 64 - __builtin_clzll(micro - 1);
+
+    Block&          block   = local();
+    add(block.buckets[latency][std::min(bucket, bucketCount)], 1);
+    add(block.sum[latency], nano);
+}
+
+Metrics::Snapshot Metrics::collect()
+{
+    Registry&                   all = registry();
+    std::lock_guard<std::mutex> lock(all.mutex);
+
+    Snapshot    total = all.retired;
+    for(void const* block: all.live)
+    {
+        ThreadBlock::addTo(total, *static_cast<Block const*>(block));
+    }
+    return total;
+}
+
+std::string Metrics::prometheus()
+{
+    Snapshot    snapshot = collect();
+    std::string result;
+    result.reserve(4096);
+
+    auto header = [&result](Description const& description)
+    {
+        appendStringParts(result, "# HELP ", description.name, ' ', description.help, "\n"
+                                  "# TYPE ", description.name, ' ', description.type, "\n");
+    };
+
+    for(std::size_t counter = 0; counter < std::size(counterDescription); ++counter)
+    {
+        header(counterDescription[counter]);
+        appendStringParts(result, counterDescription[counter].name, ' ', snapshot.counters[counter], "\n");
+    }
+
+    std::uint64_t   active = snapshot.counters[Opened] - std::min(snapshot.counters[Opened], snapshot.counters[Closed]);
+    header({"thors_connections_active", "gauge", "Connections currently being served by an HTTPServer."});
+    appendStringParts(result, "thors_connections_active ", active, "\n");
+
+    header({"thors_exceptions_total", "counter", "Exceptions thrown by the socket layer by type."});
+    appendStringParts(result, "thors_exceptions_total{type=\"domain_error\"} ",  snapshot.counters[DomainErrors], "\n"
+                              "thors_exceptions_total{type=\"runtime_error\"} ", snapshot.counters[RuntimeErrors], "\n");
+
+    for(std::size_t latency = 0; latency < LatencyCount; ++latency)
+    {
+        char const*     name    = latencyDescription[latency].name;
+        std::uint64_t   count   = 0;
+        header(latencyDescription[latency]);
+        for(std::size_t bucket = 0; bucket < bucketCount; ++bucket)
+        {
+            count += snapshot.buckets[latency][bucket];
+            // The bound is 2^bucket micro seconds written as seconds.
+            std::uint64_t   micro   = std::uint64_t{1} << bucket;
+            std::uint64_t   whole   = micro / 1000000;
+            std::uint64_t   part    = micro % 1000000;
+            std::string     fraction = std::to_string(1000000 + part).substr(1);
+            appendStringParts(result, name, "_bucket{le=\"", whole, '.', fraction, "\"} ", count, "\n");
+        }
+        count += snapshot.buckets[latency][bucketCount];
+        std::uint64_t   nano    = snapshot.sum[latency];
+        std::string     fraction = std::to_string(1000000000 + nano % 1000000000).substr(1);
+        appendStringParts(result, name, "_bucket{le=\"+Inf\"} ", count, "\n",
+                                  name, "_sum ", nano / 1000000000, '.', fraction, "\n",
+                                  name, "_count ", count, "\n");
+    }
+    return result;
+}
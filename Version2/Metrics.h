@@ -0,0 +1,100 @@
+
+#ifndef THORSANVIL_SOCKET_METRICS_H
+#define THORSANVIL_SOCKET_METRICS_H
+
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <cstdint>
+#include <cstddef>
+
+namespace ThorsAnvil
+{
+    namespace Socket
+    {
+
+/*
+ * Process wide operational counters.
+ *
+ * Each thread updates its own block of counters so recording is a plain
+ * (relaxed) load and store with no lock and no shared cache line. The
+ * blocks are only summed when the metrics are read (see collect()). When
+ * a thread exits its block is folded into a retired total so nothing it
+ * recorded is lost.
+ *
+ * Latencies are recorded in histograms with power of two buckets from
+ * 1us to ~1s (plus an overflow bucket).
+ *
+ * The socket layer counts:
+ *      Accepted, SysCalls, BytesIn, BytesOut and the exceptions it throws.
+ *      Note: SysCalls counts read/write/writev/accept/sendfile calls
+ *            (with io_uring these are the operations submitted).
+ * HTTPServer counts the rest (see ProtocolHTTP.h) and serves the
+ * result in the Prometheus text format.
+ */
+class Metrics
+{
+    public:
+        enum Counter
+        {
+            Accepted,           // Connections accepted.
+            Opened,             // Connections an HTTPServer was created for.
+            Closed,             // Connections an HTTPServer was destroyed for.
+            Requests,           // Requests read.
+            BytesIn,
+            BytesOut,
+            SysCalls,
+            ParseErrors,        // Requests with an invalid start line or headers.
+            DomainErrors,       // std::domain_error thrown by the socket layer.
+            RuntimeErrors,      // std::runtime_error thrown by the socket layer.
+            CounterCount
+        };
+        enum Latency
+        {
+            FirstByte,          // Accept to the first byte of the first request.
+            Parse,              // First byte of a request to the request being read.
+            Send,               // Sending a response.
+            LatencyCount
+        };
+        static constexpr std::size_t bucketCount = 21;      // 2^0 .. 2^20 micro seconds.
+
+        // The sum of every thread's counters.
+        struct Snapshot
+        {
+            std::uint64_t   counters[CounterCount];
+            std::uint64_t   buckets[LatencyCount][bucketCount + 1];     // Not cumulative; the last is the overflow.
+            std::uint64_t   sum[LatencyCount];                          // Nano seconds.
+        };
+
+        static void count(Counter counter, std::uint64_t value = 1)
+        {
+            add(local().counters[counter], value);
+        }
+        static void time(Latency latency, std::chrono::steady_clock::duration elapsed);
+
+        static Snapshot     collect();
+        // The Prometheus text exposition format (version 0.0.4).
+        static std::string  prometheus();
+
+    private:
+        struct Block
+        {
+            std::atomic<std::uint64_t>  counters[CounterCount];
+            std::atomic<std::uint64_t>  buckets[LatencyCount][bucketCount + 1];
+            std::atomic<std::uint64_t>  sum[LatencyCount];
+        };
+        class ThreadBlock;
+
+        // Only the owning thread writes to a block.
+        // So an atomic read-modify-write (a locked instruction) is not needed.
+        static void add(std::atomic<std::uint64_t>& value, std::uint64_t amount)
+        {
+            value.store(value.load(std::memory_order_relaxed) + amount, std::memory_order_relaxed);
+        }
+        static Block& local();
+};
+
+    }
+}
+
+#endif
@@ -1,5 +1,10 @@
 
 #include "Protocol.h"
+#include "Utility.h"
+#include <stdexcept>
+#include <cerrno>
+#include <cstring>
+#include <unistd.h>
 
 using namespace ThorsAnvil::Socket;
 
@@ -10,3 +15,24 @@ Protocol::Protocol(DataSocket& socket)
 Protocol::~Protocol()
 {}
 
+MessageSink ThorsAnvil::Socket::makeFileSink(int fileId)
+{
+    return [fileId](char const* data, std::size_t size)
+    {
+        while(size != 0)
+        {
+            ssize_t put = ::write(fileId, data, size);
+            if (put == -1)
+            {
+                if (errno == EINTR)
+                {
+                    continue;
+                }
+                throw std::runtime_error(buildErrorMessage("makeFileSink: write: ", strerror(errno)));
+            }
+            data += put;
+            size -= put;
+        }
+    };
+}
+
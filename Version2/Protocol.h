@@ -3,6 +3,9 @@
 #define THORSANVIL_SOCKET_PROTOCOL_H
 
 #include <string>
+#include <functional>
+#include <algorithm>
+#include <cstddef>
 
 namespace ThorsAnvil
 {
@@ -10,9 +13,26 @@ namespace ThorsAnvil
     {
 
 class DataSocket;
+
+// Receives the body of a message in blocks as it arrives.
+using MessageSink = std::function<void(char const* data, std::size_t size)>;
+
+// Sink that writes the body to the open file descriptor `fileId`.
+MessageSink makeFileSink(int fileId);
+
+// Sink that copies the body to an output iterator.
+template<typename OutputIterator>
+MessageSink makeIteratorSink(OutputIterator out)
+{
+    return [out](char const* data, std::size_t size) mutable {out = std::copy(data, data + size, out);};
+}
+
 class Protocol
 {
     protected:
+        // The body is passed to a MessageSink using a buffer of this size.
+        static constexpr std::size_t sinkBufferSize = 4096;
+
         DataSocket&     socket;
     public:
         Protocol(DataSocket& socket);
@@ -20,6 +40,10 @@ class Protocol
 
         virtual void sendMessage(std::string const& url, std::string const& message)    = 0;
         virtual void recvMessage(std::string& message)                                  = 0;
+        // Pass the body to `sink` as it is read from the socket.
+        // Only a fixed size buffer is used so the size of the message
+        // does not affect memory use.
+        virtual void recvMessage(MessageSink const& sink)                               = 0;
 };
 
     }
@@ -0,0 +1,268 @@
+
+#include "ProtocolFramed.h"
+#include "Socket.h"
+#include "Utility.h"
+#include <stdexcept>
+#include <algorithm>
+#include <cstring>
+#include <sys/uio.h>
+
+using namespace ThorsAnvil::Socket;
+
+namespace
+{
+    // Returns the end of the encoded value.
+    char* putVarint(char* out, std::uint64_t value)
+    {
+        while(value >= 0x80)
+        {
+            *out++  = static_cast<char>((value & 0x7F) | 0x80);
+            value   >>= 7;
+        }
+        *out++ = static_cast<char>(value);
+        return out;
+    }
+    std::size_t varintSize(std::uint64_t value)
+    {
+        std::size_t size = 1;
+        for(; value >= 0x80; value >>= 7)
+        {
+            ++size;
+        }
+        return size;
+    }
+}
+
+ProtocolFramed::ProtocolFramed(DataSocket& socket, BufferPool& pool, std::size_t maxFrameSize)
+    : Protocol(socket)
+    , bufferData(pool.acquire())
+    , bufferSize(bufferData.size())
+    , inputStart(bufferData.data())
+    , inputLength(0)
+    , maxFrameSize(maxFrameSize)
+    , frame{Request, 0, "", 0}
+    , bodyRemaining(0)
+    , requestPending(false)
+    , nextStreamId(1)
+{
+    // Small frames in both directions: don't let Nagle hold them back.
+    socket.setNoDelay();
+}
+
+/*
+ * Sending:
+ *      The head is encoded into `head` and sent with the url and body
+ *      by a single writev(). Neither the url or body are copied.
+ */
+void ProtocolFramed::sendMessage(std::string const& url, std::string const& message)
+{
+    if (requestPending)
+    {
+        sendResponse(frame.streamId, message);
+        return;
+    }
+    sendRequest(url, message);
+}
+
+std::uint64_t ProtocolFramed::sendRequest(std::string const& url, std::string const& message)
+{
+    std::uint64_t streamId = nextStreamId++;
+    putFrame(Request, streamId, url, message);
+    return streamId;
+}
+
+void ProtocolFramed::sendResponse(std::uint64_t streamId, std::string const& message)
+{
+    if (requestPending && streamId == frame.streamId)
+    {
+        requestPending = false;
+    }
+    putFrame(Response, streamId, "", message);
+}
+
+void ProtocolFramed::putFrame(FrameType type, std::uint64_t streamId, std::string const& url, std::string const& message)
+{
+    std::uint64_t   length  = 1 + varintSize(streamId) + varintSize(url.size()) + url.size() + message.size();
+    char*           out     = putVarint(head, length);
+    *out++  = static_cast<char>(type);
+    out     = putVarint(out, streamId);
+    out     = putVarint(out, url.size());
+
+    iovec           parts[3] = {{head, static_cast<std::size_t>(out - head)},
+                                {const_cast<char*>(url.data()), url.size()},
+                                {const_cast<char*>(message.data()), message.size()}};
+    socket.putMessageData(parts, 3);
+}
+
+/*
+ * Receiving:
+ *      The head is decoded a byte at a time from the buffer (reading more
+ *      from the socket only when the buffer is empty).
+ *      The body is copied from the buffer and any remainder is read
+ *      directly into the caller's buffer (never past the end of the frame).
+ */
+bool ProtocolFramed::hasMessage()
+{
+    skipBody();
+    return inputLength != 0 || fillBuffer(1);
+}
+
+void ProtocolFramed::recvMessage(std::string& message)
+{
+    if (!getFrameHead())
+    {
+        throw std::runtime_error(buildErrorMessage("ProtocolFramed::", __func__, ": Connection closed before message"));
+    }
+    // The size is known so the string is only allocated once.
+    message.resize(frame.size);
+    std::size_t dataRead = 0;
+    while(dataRead < frame.size)
+    {
+        dataRead += getBody(&message[dataRead], frame.size - dataRead);
+    }
+}
+
+void ProtocolFramed::recvMessage(MessageSink const& sink)
+{
+    if (!getFrameHead())
+    {
+        throw std::runtime_error(buildErrorMessage("ProtocolFramed::", __func__, ": Connection closed before message"));
+    }
+    // What is already buffered is passed on without being copied.
+    std::size_t buffered = std::min(bodyRemaining, inputLength);
+    if (buffered != 0)
+    {
+        sink(inputStart, buffered);
+        inputStart      += buffered;
+        inputLength     -= buffered;
+        bodyRemaining   -= buffered;
+    }
+    char        buffer[sinkBufferSize];
+    while(bodyRemaining != 0)
+    {
+        std::size_t got = getBody(buffer, std::min(bodyRemaining, sinkBufferSize));
+        sink(buffer, got);
+    }
+}
+
+bool ProtocolFramed::getFrameHead()
+{
+    // Anything left of the last frame is not part of this one.
+    skipBody();
+    if (inputLength == 0 && !fillBuffer(1))
+    {
+        return false;
+    }
+
+    std::uint64_t   length  = getVarint();
+    if (length > maxFrameSize)
+    {
+        throw std::runtime_error(buildErrorMessage("ProtocolFramed::", __func__, ": Frame too large: ", length, " (max ", maxFrameSize, ")"));
+    }
+    unsigned char   type    = getByte();
+    if (type != Request && type != Response)
+    {
+        throw std::runtime_error(buildErrorMessage("ProtocolFramed::", __func__, ": Invalid frame type: ", static_cast<int>(type)));
+    }
+    frame.type      = static_cast<FrameType>(type);
+    frame.streamId  = getVarint();
+    std::uint64_t   urlSize = getVarint();
+    // The bytes of `length` used by the head.
+    std::uint64_t   used    = 1 + varintSize(frame.streamId) + varintSize(urlSize);
+    // Note: `urlSize` is from the peer (up to 2^64 - 1) so `used + urlSize` could wrap.
+    if (used > length || urlSize > length - used)
+    {
+        throw std::runtime_error(buildErrorMessage("ProtocolFramed::", __func__, ": Invalid url size: ", urlSize, " (frame ", length, ")"));
+    }
+
+    frame.url.resize(urlSize);
+    bodyRemaining   = urlSize;
+    for(std::size_t urlRead = 0; urlRead < urlSize;)
+    {
+        urlRead += getBody(&frame.url[urlRead], urlSize - urlRead);
+    }
+    frame.size      = length - used - urlSize;
+    bodyRemaining   = frame.size;
+    requestPending  = frame.type == Request;
+    return true;
+}
+
+// Make sure at least `size` bytes are buffered.
+// Returns false if the connection is closed first.
+bool ProtocolFramed::fillBuffer(std::size_t size)
+{
+    // The buffer is mirrored: wrap the start back into the first copy.
+    // There is then `bufferSize` bytes of contiguous space after it.
+    if (inputStart >= bufferData.data() + bufferSize)
+    {
+        inputStart -= bufferSize;
+    }
+    while(inputLength < size)
+    {
+        std::size_t got = socket.getMessageData(inputStart + inputLength, bufferSize - inputLength, [](std::size_t){return true;});
+        if (got == 0)
+        {
+            return false;
+        }
+        inputLength += got;
+    }
+    return true;
+}
+
+unsigned char ProtocolFramed::getByte()
+{
+    if (inputLength == 0 && !fillBuffer(1))
+    {
+        throw std::runtime_error(buildErrorMessage("ProtocolFramed::", __func__, ": Connection closed inside frame"));
+    }
+    --inputLength;
+    return static_cast<unsigned char>(*inputStart++);
+}
+
+std::uint64_t ProtocolFramed::getVarint()
+{
+    std::uint64_t   value = 0;
+    for(int shift = 0; shift < 64; shift += 7)
+    {
+        unsigned char byte = getByte();
+        value |= static_cast<std::uint64_t>(byte & 0x7F) << shift;
+        if ((byte & 0x80) == 0)
+        {
+            return value;
+        }
+    }
+    throw std::runtime_error(buildErrorMessage("ProtocolFramed::", __func__, ": Invalid varint"));
+}
+
+// Read up to `size` bytes of the body (at most bodyRemaining).
+std::size_t ProtocolFramed::getBody(char* buffer, std::size_t size)
+{
+    size = std::min(size, bodyRemaining);
+    std::size_t got;
+    if (inputLength != 0)
+    {
+        got = std::min(size, inputLength);
+        std::memcpy(buffer, inputStart, got);
+        inputStart  += got;
+        inputLength -= got;
+    }
+    else
+    {
+        got = socket.getMessageData(buffer, size, [](std::size_t){return true;});
+        if (got == 0 && size != 0)
+        {
+            throw std::runtime_error(buildErrorMessage("ProtocolFramed::", __func__, ": Connection closed inside frame"));
+        }
+    }
+    bodyRemaining -= got;
+    return got;
+}
+
+void ProtocolFramed::skipBody()
+{
+    char    buffer[sinkBufferSize];
+    while(bodyRemaining != 0)
+    {
+        getBody(buffer, sinkBufferSize);
+    }
+}
@@ -0,0 +1,108 @@
+
+#ifndef THORSANVIL_SOCKET_PROTOCOL_FRAMED_H
+#define THORSANVIL_SOCKET_PROTOCOL_FRAMED_H
+
+#include "Protocol.h"
+#include "BufferPool.h"
+#include <string>
+#include <cstdint>
+#include <cstddef>
+
+namespace ThorsAnvil
+{
+    namespace Socket
+    {
+
+/*
+ * A binary protocol for many messages on one connection.
+ *
+ * Every message is a frame:
+ *      <varint length>             Size of everything after the length.
+ *      <type>                      One byte (FrameType).
+ *      <varint stream id>          Matches a response to its request.
+ *      <varint url size> <url>
+ *      <body>
+ * Varints are 7 bits a byte, least significant first (as protobuf).
+ *
+ * As the size of each frame is known up front:
+ *      No close (or scan for a terminator) is needed to find the end of a message.
+ *      The body is read straight into a string allocated once at the right size.
+ * Small frames are read through a buffer so several are taken per read().
+ * Each frame is sent with a single writev().
+ *
+ * Requests and responses can be interleaved: a client can send several
+ * requests (sendRequest()) before reading any responses and the server can
+ * answer them in any order (sendResponse()). The stream id of the frame just
+ * received is available from getFrame().
+ */
+class ProtocolFramed: public Protocol
+{
+    public:
+        enum FrameType: unsigned char {Request = 0, Response = 1};
+
+        // The head of the last frame received.
+        struct Frame
+        {
+            FrameType       type;
+            std::uint64_t   streamId;
+            std::string     url;
+            std::size_t     size;       // Size of the body.
+        };
+
+        // A frame larger than this is rejected (before its body is allocated).
+        static constexpr std::size_t defaultMaxFrameSize = 64 * 1024 * 1024;
+
+    private:
+        // length + type + stream id + url size
+        static constexpr std::size_t maxHeadSize = 10 + 1 + 10 + 10;
+
+        BufferPool::Buffer  bufferData;
+        std::size_t         bufferSize;
+        // Data read but not used: [inputStart, inputStart + inputLength).
+        // The buffer is a mirrored ring so this is always contiguous.
+        char*               inputStart;
+        std::size_t         inputLength;
+        std::size_t         maxFrameSize;
+        Frame               frame;
+        // The body of the current frame still to be read.
+        std::size_t         bodyRemaining;
+        // Requests received that sendMessage() has not answered.
+        bool                requestPending;
+        std::uint64_t       nextStreamId;
+        char                head[maxHeadSize];
+
+        bool            fillBuffer(std::size_t size);
+        unsigned char   getByte();
+        std::uint64_t   getVarint();
+        std::size_t     getBody(char* buffer, std::size_t size);
+        void            skipBody();
+        bool            getFrameHead();
+        void            putFrame(FrameType type, std::uint64_t streamId, std::string const& url, std::string const& message);
+
+    public:
+        // The input buffer is taken from `pool`.
+        ProtocolFramed(DataSocket& socket, BufferPool& pool = BufferPool::forThread(), std::size_t maxFrameSize = defaultMaxFrameSize);
+
+        // Protocol interface.
+        // sendMessage() answers the last request received if it has not
+        // been answered, otherwise it sends a new request.
+        // recvMessage() reads the next frame (request or response) and
+        // throws if the connection is closed first.
+        void sendMessage(std::string const& url, std::string const& message) override;
+        void recvMessage(std::string& message)                               override;
+        void recvMessage(MessageSink const& sink)                            override;
+
+        // Returns the stream id of the request (to match with its response).
+        std::uint64_t   sendRequest(std::string const& url, std::string const& message);
+        void            sendResponse(std::uint64_t streamId, std::string const& message);
+
+        // True if there is another frame to read.
+        // False if the other end closed the connection.
+        bool            hasMessage();
+        Frame const&    getFrame() const    {return frame;}
+};
+
+    }
+}
+
+#endif
@@ -60,3 +60,15 @@ void ProtocolSimple::recvMessage(std::string& message)
     }
 }
 
+void ProtocolSimple::recvMessage(MessageSink const& sink)
+{
+    char            buffer[sinkBufferSize];
+
+    // Pass on each block as soon as it is read.
+    std::size_t got;
+    while((got = socket.getMessageData(buffer, sinkBufferSize, [](std::size_t){return true;})) != 0)
+    {
+        sink(buffer, got);
+    }
+}
+
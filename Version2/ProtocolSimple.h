@@ -15,6 +15,7 @@ class ProtocolSimple: public Protocol
         using Protocol::Protocol;
         void sendMessage(std::string const& url, std::string const& message) override;
         void recvMessage(std::string& message)                               override;
+        void recvMessage(MessageSink const& sink)                            override;
 };
 
     }
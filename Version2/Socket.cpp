@@ -1,19 +1,29 @@
 
 #include "Socket.h"
 #include "Utility.h"
+#include "Metrics.h"
+#include "Trace.h"
 #include <arpa/inet.h>
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/sendfile.h>
+#include <netinet/tcp.h>
 #include <unistd.h>
+#include <fcntl.h>
 #include <sstream>
 #include <stdexcept>
+#include <algorithm>
+#include <climits>
 
 #include <iostream>
 
 using namespace ThorsAnvil::Socket;
 
-BaseSocket::BaseSocket(int socketId)
+BaseSocket::BaseSocket(int socketId, bool nonBlocking)
     : socketId(socketId)
+    , nonBlocking(nonBlocking)
+    , socketIO(nullptr)
 {
     if (socketId == -1)
     {
@@ -56,14 +66,16 @@ void BaseSocket::close()
     while(true)
     {
         int state = ::close(socketId);
-        if (state == invalidSocketId)
+        if (state == 0)
         {
             break;
         }
         switch(errno)
         {
-            case EBADF: throw std::domain_error(buildErrorMessage("BaseSocket::", __func__, ": close: EBADF: ", socketId, " ", strerror(errno)));
-            case EIO:   throw std::runtime_error(buildErrorMessage("BaseSocket::", __func__, ": close: EIO:  ", socketId, " ", strerror(errno)));
+            case EBADF: Metrics::count(Metrics::DomainErrors);
+                        throw std::domain_error(buildErrorMessage("BaseSocket::", __func__, ": close: EBADF: ", socketId, " ", strerror(errno)));
+            case EIO:   Metrics::count(Metrics::RuntimeErrors);
+                        throw std::runtime_error(buildErrorMessage("BaseSocket::", __func__, ": close: EIO:  ", socketId, " ", strerror(errno)));
             case EINTR:
             {
                         // TODO: Check for user interrupt flags.
@@ -71,7 +83,8 @@ void BaseSocket::close()
                         //       so continue normal operations.
                 break;
             }
-            default:    throw std::runtime_error(buildErrorMessage("BaseSocket::", __func__, ": close: ???:  ", socketId, " ", strerror(errno)));
+            default:    Metrics::count(Metrics::RuntimeErrors);
+                        throw std::runtime_error(buildErrorMessage("BaseSocket::", __func__, ": close: ???:  ", socketId, " ", strerror(errno)));
         }
     }
     socketId = invalidSocketId;
@@ -81,10 +94,67 @@ void BaseSocket::swap(BaseSocket& other) noexcept
 {
     using std::swap;
     swap(socketId,   other.socketId);
+    swap(nonBlocking, other.nonBlocking);
+    swap(readYield,  other.readYield);
+    swap(writeYield, other.writeYield);
+    swap(socketIO,   other.socketIO);
+}
+
+int BaseSocket::ioAccept(int flags)
+{
+    int newSocket;
+    if (socketIO != nullptr)
+    {
+        newSocket = socketIO->accept(socketId, flags);
+    }
+    else
+    {
+        struct  sockaddr_storage    serverStorage;
+        socklen_t                   addr_size   = sizeof serverStorage;
+        newSocket = ::accept4(socketId, (struct sockaddr*)&serverStorage, &addr_size, flags | SOCK_CLOEXEC);
+    }
+    Metrics::count(Metrics::SysCalls);
+    if (newSocket != -1)
+    {
+        Metrics::count(Metrics::Accepted);
+    }
+    return newSocket;
+}
+
+ssize_t BaseSocket::ioSendFile(int fileId, off_t* offset, std::size_t size)
+{
+    ssize_t put = socketIO == nullptr ? ::sendfile(socketId, fileId, offset, size) : socketIO->sendfile(socketId, fileId, offset, size);
+    Metrics::count(Metrics::SysCalls);
+    if (put > 0)
+    {
+        Metrics::count(Metrics::BytesOut, put);
+    }
+    return put;
+}
+
+void BaseSocket::setNonBlocking(std::function<void()>&& read, std::function<void()>&& write)
+{
+    if (socketId == invalidSocketId)
+    {
+        throw std::logic_error(buildErrorMessage("BaseSocket::", __func__, ": called on a bad socket object (this object was moved)"));
+    }
+    if (!nonBlocking)
+    {
+        int flags = ::fcntl(socketId, F_GETFL, 0);
+        if (flags == -1 || ::fcntl(socketId, F_SETFL, flags | O_NONBLOCK) == -1)
+        {
+            throw std::runtime_error(buildErrorMessage("BaseSocket::", __func__, ": fcntl: ", strerror(errno)));
+        }
+        nonBlocking = true;
+    }
+    readYield   = std::move(read);
+    writeYield  = std::move(write);
 }
 
 BaseSocket::BaseSocket(BaseSocket&& move) noexcept
     : socketId(invalidSocketId)
+    , nonBlocking(false)
+    , socketIO(nullptr)
 {
     move.swap(*this);
 }
@@ -95,9 +165,45 @@ BaseSocket& BaseSocket::operator=(BaseSocket&& move) noexcept
     return *this;
 }
 
-ConnectSocket::ConnectSocket(std::string const& host, int port)
-    : DataSocket(::socket(PF_INET, SOCK_STREAM, 0))
+// On failure the socket is closed (the caller is a constructor that then fails).
+void BaseSocket::setOption(int level, int name, int value, char const* optionName, char const* className, char const* func)
+{
+    if (::setsockopt(socketId, level, name, &value, sizeof(value)) != 0)
+    {
+        int error = errno;
+        close();
+        throw std::runtime_error(buildErrorMessage(className, func, ": setsockopt(", optionName, "): ", strerror(error)));
+    }
+}
+
+void BaseSocket::setOptions(SocketOptions const& options, char const* className, char const* func)
 {
+    if (options.noDelay)
+    {
+        setOption(IPPROTO_TCP, TCP_NODELAY, 1, "TCP_NODELAY", className, func);
+    }
+    // The buffer sizes must be set before the connection is made
+    // (the TCP window scale is agreed in the handshake).
+    if (options.receiveBuffer != 0)
+    {
+        setOption(SOL_SOCKET, SO_RCVBUF, options.receiveBuffer, "SO_RCVBUF", className, func);
+    }
+    if (options.sendBuffer != 0)
+    {
+        setOption(SOL_SOCKET, SO_SNDBUF, options.sendBuffer, "SO_SNDBUF", className, func);
+    }
+}
+
+ConnectSocket::ConnectSocket(std::string const& host, int port, SocketOptions const& options)
+    : DataSocket(::socket(PF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0))
+{
+    setOptions(options, "ConnectSocket::", __func__);
+    if (options.fastOpen != 0)
+    {
+        // connect() returns immediately; the SYN is sent with the first write.
+        setOption(IPPROTO_TCP, TCP_FASTOPEN_CONNECT, 1, "TCP_FASTOPEN_CONNECT", "ConnectSocket::", __func__);
+    }
+
     struct sockaddr_in serverAddr{};
     serverAddr.sin_family       = AF_INET;
     serverAddr.sin_port         = htons(port);
@@ -110,9 +216,34 @@ ConnectSocket::ConnectSocket(std::string const& host, int port)
     }
 }
 
-ServerSocket::ServerSocket(int port)
-    : BaseSocket(::socket(PF_INET, SOCK_STREAM, 0))
+namespace
+{
+    SocketOptions reuseOptions(bool reusePort)
+    {
+        SocketOptions   options;
+        options.reuseAddress    = reusePort;
+        options.reusePort       = reusePort;
+        return options;
+    }
+}
+
+ServerSocket::ServerSocket(int port, bool reusePort)
+    : ServerSocket(port, reuseOptions(reusePort))
+{}
+
+ServerSocket::ServerSocket(int port, SocketOptions const& options)
+    : BaseSocket(::socket(PF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0))
 {
+    if (options.reuseAddress)
+    {
+        setOption(SOL_SOCKET, SO_REUSEADDR, 1, "SO_REUSEADDR", "ServerSocket::", __func__);
+    }
+    if (options.reusePort)
+    {
+        setOption(SOL_SOCKET, SO_REUSEPORT, 1, "SO_REUSEPORT", "ServerSocket::", __func__);
+    }
+    setOptions(options, "ServerSocket::", __func__);
+
     struct sockaddr_in serverAddr;
     bzero((char*)&serverAddr, sizeof(serverAddr));
     serverAddr.sin_family       = AF_INET;
@@ -125,86 +256,242 @@ ServerSocket::ServerSocket(int port)
         throw std::runtime_error(buildErrorMessage("ServerSocket::", __func__, ": bind: ", strerror(errno)));
     }
 
-    if (::listen(getSocketId(), maxConnectionBacklog) != 0)
+    if (options.deferAccept != 0)
+    {
+        setOption(IPPROTO_TCP, TCP_DEFER_ACCEPT, options.deferAccept, "TCP_DEFER_ACCEPT", "ServerSocket::", __func__);
+    }
+    if (options.fastOpen != 0)
+    {
+        setOption(IPPROTO_TCP, TCP_FASTOPEN, options.fastOpen, "TCP_FASTOPEN", "ServerSocket::", __func__);
+    }
+
+    if (::listen(getSocketId(), options.backlog) != 0)
     {
         close();
         throw std::runtime_error(buildErrorMessage("ServerSocket::", __func__, ": listen: ", strerror(errno)));
     }
 }
 
-DataSocket ServerSocket::accept()
+DataSocket ServerSocket::accept(int flags)
 {
     if (getSocketId() == invalidSocketId)
     {
         throw std::logic_error(buildErrorMessage("ServerSocket::", __func__, ": accept called on a bad socket object (this object was moved)"));
     }
 
-    struct  sockaddr_storage    serverStorage;
-    socklen_t                   addr_size   = sizeof serverStorage;
-    int newSocket = ::accept(getSocketId(), (struct sockaddr*)&serverStorage, &addr_size);
-    if (newSocket == -1)
+    Trace::Scope    trace(Trace::Accept, getSocketId());
+    while(true)
     {
-        throw std::runtime_error(buildErrorMessage("ServerSocket:", __func__, ": accept: ", strerror(errno)));
+        int newSocket = ioAccept(flags);
+        if (newSocket == -1)
+        {
+            switch(errno)
+            {
+                case EINTR:
+                case ECONNABORTED:
+                {
+                    // The pending connection went away before we got to it.
+                    // Simply wait for the next one.
+                    continue;
+                }
+                case EAGAIN:
+                {
+                    // Non-blocking socket with no pending connection.
+                    // Let something else run until a connection arrives then retry.
+                    yieldRead();
+                    continue;
+                }
+                default:
+                {
+                    Metrics::count(Metrics::RuntimeErrors);
+                    throw std::runtime_error(buildErrorMessage("ServerSocket:", __func__, ": accept: ", strerror(errno)));
+                }
+            }
+        }
+        return DataSocket(newSocket, (flags & SOCK_NONBLOCK) != 0);
     }
-    return DataSocket(newSocket);
 }
 
-void DataSocket::putMessageData(char const* buffer, std::size_t size)
+std::size_t ServerSocket::acceptPending(std::vector<DataSocket>& accepted, std::size_t max, int flags)
 {
-    std::size_t     dataWritten = 0;
+    if (getSocketId() == invalidSocketId)
+    {
+        throw std::logic_error(buildErrorMessage("ServerSocket::", __func__, ": accept called on a bad socket object (this object was moved)"));
+    }
 
-    while(dataWritten < size)
+    std::size_t count = 0;
+    while(count < max)
     {
-        std::size_t put = write(getSocketId(), buffer + dataWritten, size - dataWritten);
-        if (put == static_cast<std::size_t>(-1))
+        int newSocket = ioAccept(flags);
+        if (newSocket == -1)
         {
             switch(errno)
             {
-                case EINVAL:
-                case EBADF:
-                case ECONNRESET:
-                case ENXIO:
-                case EPIPE:
-                {
-                    // Fatal error. Programming bug
-                    throw std::domain_error(buildErrorMessage("DataSocket::", __func__, ": write: critical error: ", strerror(errno)));
-                }
-                case EDQUOT:
-                case EFBIG:
-                case EIO:
-                case ENETDOWN:
-                case ENETUNREACH:
-                case ENOSPC:
-                {
-                    // Resource acquisition failure or device error
-                    throw std::runtime_error(buildErrorMessage("DataSocket::", __func__, ": write: resource failure: ", strerror(errno)));
-                }
                 case EINTR:
-                        // TODO: Check for user interrupt flags.
-                        //       Beyond the scope of this project
-                        //       so continue normal operations.
-                case EAGAIN:
-                {
-                    // Temporary error.
-                    // Simply retry the read.
+                case ECONNABORTED:
                     continue;
-                }
+                case EAGAIN:
+                    // Nothing else is waiting.
+                    return count;
                 default:
                 {
-                    throw std::runtime_error(buildErrorMessage("DataSocket::", __func__, ": write: returned -1: ", strerror(errno)));
+                    Metrics::count(Metrics::RuntimeErrors);
+                    throw std::runtime_error(buildErrorMessage("ServerSocket:", __func__, ": accept: ", strerror(errno)));
                 }
             }
         }
+        accepted.emplace_back(newSocket, (flags & SOCK_NONBLOCK) != 0);
+        ++count;
+    }
+    return count;
+}
+
+void DataSocket::putMessageData(char const* buffer, std::size_t size)
+{
+    Trace::Scope    trace(Trace::Write, getSocketId());
+    std::size_t     dataWritten = 0;
+
+    while(dataWritten < size)
+    {
+        std::size_t put = ioWrite(buffer + dataWritten, size - dataWritten);
+        if (put == static_cast<std::size_t>(-1))
+        {
+            putMessageDataError(__func__);
+            continue;
+        }
         dataWritten += put;
     }
     return;
 }
 
+void DataSocket::putMessageData(struct iovec* data, std::size_t count, bool more)
+{
+    Trace::Scope    trace(Trace::Write, getSocketId());
+    while(count != 0)
+    {
+        // Only the last batch of buffers can be the end of the data.
+        std::size_t put = ioWritev(data, std::min<std::size_t>(count, IOV_MAX), more || count > IOV_MAX);
+        if (put == static_cast<std::size_t>(-1))
+        {
+            putMessageDataError(__func__);
+            continue;
+        }
+
+        // Skip the buffers that were completely written.
+        while(count != 0 && put >= data->iov_len)
+        {
+            put -= data->iov_len;
+            ++data;
+            --count;
+        }
+        // Move the start of a partially written buffer.
+        if (count != 0)
+        {
+            data->iov_base  = static_cast<char*>(data->iov_base) + put;
+            data->iov_len   -= put;
+        }
+    }
+}
+
+void DataSocket::putMessageFile(int fileId, off_t offset, std::size_t size)
+{
+    Trace::Scope    trace(Trace::Write, getSocketId());
+    std::size_t     dataWritten = 0;
+
+    while(dataWritten < size)
+    {
+        // sendfile() moves `offset` forward by the amount written.
+        std::size_t put = ioSendFile(fileId, &offset, size - dataWritten);
+        if (put == static_cast<std::size_t>(-1))
+        {
+            putMessageDataError(__func__);
+            continue;
+        }
+        if (put == 0)
+        {
+            throw std::runtime_error(buildErrorMessage("DataSocket::", __func__, ": sendfile: file shorter than expected: ", dataWritten, " of ", size));
+        }
+        dataWritten += put;
+    }
+}
+
+// Handle the error from a failed write.
+// Throws if the error is fatal. If it returns the write should be retried.
+void DataSocket::putMessageDataError(char const* func)
+{
+    switch(errno)
+    {
+        case EINVAL:
+        case EBADF:
+        case ECONNRESET:
+        case ENXIO:
+        case EPIPE:
+        {
+            // Fatal error. Programming bug
+            Metrics::count(Metrics::DomainErrors);
+            throw std::domain_error(buildErrorMessage("DataSocket::", func, ": write: critical error: ", strerror(errno)));
+        }
+        case EDQUOT:
+        case EFBIG:
+        case EIO:
+        case ENETDOWN:
+        case ENETUNREACH:
+        case ENOSPC:
+        {
+            // Resource acquisition failure or device error
+            Metrics::count(Metrics::RuntimeErrors);
+            throw std::runtime_error(buildErrorMessage("DataSocket::", func, ": write: resource failure: ", strerror(errno)));
+        }
+        case EINTR:
+        {
+                // TODO: Check for user interrupt flags.
+                //       Beyond the scope of this project
+                //       so continue normal operations.
+            return;
+        }
+        case EAGAIN:
+        {
+            // Non-blocking socket with a full send buffer.
+            // Let something else run until there is space then retry the write.
+            yieldWrite();
+            return;
+        }
+        default:
+        {
+            Metrics::count(Metrics::RuntimeErrors);
+            throw std::runtime_error(buildErrorMessage("DataSocket::", func, ": write: returned -1: ", strerror(errno)));
+        }
+    }
+}
+
 void DataSocket::putMessageClose()
 {
     if (::shutdown(getSocketId(), SHUT_WR) != 0)
     {
+        Metrics::count(Metrics::DomainErrors);
         throw std::domain_error(buildErrorMessage("HTTPProtocol::", __func__, ": shutdown: critical error: ", strerror(errno)));
     }
 }
 
+bool DataSocket::isIdle()
+{
+    if (getSocketId() == invalidSocketId)
+    {
+        return false;
+    }
+    char    data;
+    ssize_t get = ::recv(getSocketId(), &data, 1, MSG_PEEK | MSG_DONTWAIT);
+    // 0:  The other end closed the connection.
+    // >0: There is unread data.
+    return get == -1 && (errno == EAGAIN || errno == EWOULDBLOCK);
+}
+
+void DataSocket::setNoDelay(bool noDelay)
+{
+    int on = noDelay ? 1 : 0;
+    if (::setsockopt(getSocketId(), IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on)) != 0
+        && errno != EOPNOTSUPP)     // Not a TCP socket (ie a unix domain socket) so nothing to do.
+    {
+        throw std::runtime_error(buildErrorMessage("DataSocket::", __func__, ": setsockopt: ", strerror(errno)));
+    }
+}
@@ -5,24 +5,103 @@
 #include <string>
 #include <vector>
 #include <sstream>
+#include <functional>
+#include <chrono>
+#include <sys/types.h>
+#include <sys/socket.h>
+
+struct iovec;
 
 namespace ThorsAnvil
 {
     namespace Socket
     {
 
+// An alternative implementation of the system calls a socket uses.
+//
+// By default a socket calls read()/write()/writev()/accept()/sendfile() directly.
+// An event loop can install one of these to perform the operations
+// another way (ie io_uring). The functions behave like the system
+// calls: on failure they return -1 and set errno.
+class SocketIO
+{
+    public:
+        virtual ~SocketIO() {}
+        virtual ssize_t read(int socketId, char* buffer, std::size_t size)                = 0;
+        virtual ssize_t write(int socketId, char const* buffer, std::size_t size)         = 0;
+        // `flags` is 0 or MSG_MORE (more data follows: don't send a short packet).
+        virtual ssize_t writev(int socketId, struct iovec const* data, int count, int flags) = 0;
+        // `flags` as for accept4() (SOCK_NONBLOCK).
+        virtual int     accept(int socketId, int flags)                                   = 0;
+        // As sendfile(): `offset` is moved forward by the amount written.
+        virtual ssize_t sendfile(int socketId, int fileId, off_t* offset, std::size_t size) = 0;
+};
+
+// Options applied when a ServerSocket or ConnectSocket is created.
+// The defaults leave the system settings alone (apart from the backlog).
+struct SocketOptions
+{
+    // ServerSocket: The length of the queue of connections waiting to be accepted.
+    // Note: A burst of connections larger than this has SYNs dropped and
+    //       retransmitted by the client a second later.
+    int     backlog         = SOMAXCONN;
+    // ServerSocket: SO_REUSEADDR/SO_REUSEPORT.
+    bool    reuseAddress    = false;
+    bool    reusePort       = false;
+    // TCP_NODELAY. On a ServerSocket it is inherited by accepted sockets.
+    bool    noDelay         = false;
+    // ServerSocket: TCP_DEFER_ACCEPT. Connections are not accepted until data
+    // arrives (or this many seconds pass). 0 is off.
+    int     deferAccept     = 0;
+    // TCP Fast Open.
+    // ServerSocket: The length of the queue of connections that sent data with their SYN (0 is off).
+    // ConnectSocket: Non zero sends the first write with the SYN (TCP_FASTOPEN_CONNECT).
+    int     fastOpen        = 0;
+    // SO_RCVBUF/SO_SNDBUF in bytes (0 is the system default).
+    // On a ServerSocket these are inherited by accepted sockets.
+    int     receiveBuffer   = 0;
+    int     sendBuffer      = 0;
+};
+
 // An RAII base class for handling sockets.
 // Socket is movable but not copyable.
 class BaseSocket
 {
-
-    int     socketId;
+    friend class EventLoop;
+    friend class AsyncSocket;
+    friend class AsyncServerSocket;
+    friend class ProtocolHTTP;
+
+    int                     socketId;
+    bool                    nonBlocking;
+    std::function<void()>   readYield;
+    std::function<void()>   writeYield;
+    SocketIO*               socketIO;
     protected:
         static constexpr int invalidSocketId      = -1;
 
         // Designed to be a base class not used used directly.
-        BaseSocket(int socketId);
+        // `nonBlocking` is true if the socket was created non-blocking.
+        BaseSocket(int socketId, bool nonBlocking = false);
         int getSocketId() const {return socketId;}
+
+        // The system calls (or the installed SocketIO equivalent).
+        ssize_t ioRead(char* buffer, std::size_t size);
+        ssize_t ioWrite(char const* buffer, std::size_t size);
+        ssize_t ioWritev(struct iovec const* data, int count, bool more = false);
+        ssize_t ioSendFile(int fileId, off_t* offset, std::size_t size);
+        // accept4(): the new socket is always close-on-exec.
+        int     ioAccept(int flags = 0);
+
+        // Apply the options that are set on any socket.
+        // Failure closes the socket and throws.
+        void    setOptions(SocketOptions const& options, char const* className, char const* func);
+        void    setOption(int level, int name, int value, char const* optionName, char const* className, char const* func);
+
+        // Called when a non-blocking socket would block.
+        // If no yield function has been set we simply spin and retry.
+        void yieldRead()  const {if (readYield)  {readYield();}}
+        void yieldWrite() const {if (writeYield) {writeYield();}}
     public:
         virtual ~BaseSocket();
 
@@ -35,20 +114,61 @@ class BaseSocket
 
         // User can manually call close
         void close();
+
+        // Put the socket into non-blocking mode.
+        // When a read/write/accept would block the socket calls the
+        // appropriate yield function then retries the operation. This
+        // allows an event loop to run other work until the socket is ready.
+        void setNonBlocking(std::function<void()>&& readYield, std::function<void()>&& writeYield);
+
+        // Replace the system calls used by this socket (nullptr restores them).
+        // Allows an in-memory substitute to be used by tests and benchmarks.
+        // Note: Not owned; `io` must outlive its use by the socket.
+        void setSocketIO(SocketIO* io)  {socketIO = io;}
 };
 
 // A class that can read/write to a socket
 class DataSocket: public BaseSocket
 {
+    using Clock = std::chrono::steady_clock;
+    // When the connection was accepted (or connected).
+    Clock::time_point   openTime;
+
+    void        putMessageDataError(char const* func);
     public:
-        DataSocket(int socketId)
-            : BaseSocket(socketId)
+        DataSocket(int socketId, bool nonBlocking = false)
+            : BaseSocket(socketId, nonBlocking)
+            , openTime(Clock::now())
         {}
 
+        Clock::time_point getOpenTime() const {return openTime;}
+
         template<typename F>
         std::size_t getMessageData(char* buffer, std::size_t size, F scanForEnd = [](std::size_t){return false;});
         void        putMessageData(char const* buffer, std::size_t size);
+        // Scatter/Gather write.
+        // Writes all the buffers (using as few writev() calls as possible).
+        // Note: The iovec array is modified to track partial writes.
+        // If `more` is true the caller is about to send more data (MSG_MORE):
+        // a short write (ie a response head) is held back to share a packet with it.
+        void        putMessageData(struct iovec* data, std::size_t count, bool more = false);
+        // Zero copy write of `size` bytes from the file `fileId` starting at `offset`.
+        // The kernel copies the data directly from the page cache to the socket.
+        // Note: An EventLoop using io_uring (which has no sendfile) reads the file
+        //       into a buffer and sends it through the ring instead.
+        void        putMessageFile(int fileId, off_t offset, std::size_t size);
         void        putMessageClose();
+
+        // Disable Nagle's algorithm.
+        // Request/response protocols that keep the connection open need this
+        // otherwise small writes are held back waiting for a delayed ACK.
+        void        setNoDelay(bool noDelay = true);
+
+        // True if the connection is still open and there is nothing to read.
+        // Checked without blocking. Used to decide if an idle (pooled)
+        // connection can be reused: if the other end closed it (or sent
+        // something unexpected) it can't.
+        bool        isIdle();
 };
 
 // A class the conects to a remote machine
@@ -56,19 +176,29 @@ class DataSocket: public BaseSocket
 class ConnectSocket: public DataSocket
 {
     public:
-        ConnectSocket(std::string const& host, int port);
+        ConnectSocket(std::string const& host, int port, SocketOptions const& options = SocketOptions{});
 };
 
 // A server socket that listens on a port for a connection
 class ServerSocket: public BaseSocket
 {
-    static constexpr int maxConnectionBacklog = 5;
     public:
-        ServerSocket(int port);
+        // If `reusePort` is true the socket is opened with SO_REUSEADDR and SO_REUSEPORT.
+        // This allows several ServerSockets (one per thread) to listen on the
+        // same port with the kernel load balancing connections between them.
+        ServerSocket(int port, bool reusePort = false);
+        ServerSocket(int port, SocketOptions const& options);
 
         // An accepts waits for a connection and returns a socket
-        // object that can be used by the client for communication
-        DataSocket accept();
+        // object that can be used by the client for communication.
+        // `flags` as for accept4(): SOCK_NONBLOCK creates a non-blocking socket
+        // (saving the fcntl() calls when it is passed to an event loop).
+        DataSocket accept(int flags = 0);
+
+        // Accept the connections that are already waiting (at most `max`)
+        // without waiting for more. Returns the number added to `accepted`.
+        // Note: The socket must be non-blocking (see setNonBlocking()).
+        std::size_t acceptPending(std::vector<DataSocket>& accepted, std::size_t max, int flags = 0);
 };
 
     }
@@ -1,6 +1,9 @@
 
 #include "Utility.h"
+#include "Metrics.h"
+#include "Trace.h"
 #include <stdexcept>
+#include <cstring>
 #include <sys/types.h>
 #include <sys/uio.h>
 #include <unistd.h>
@@ -10,6 +13,55 @@ namespace ThorsAnvil
     namespace Socket
     {
 
+inline ssize_t BaseSocket::ioRead(char* buffer, std::size_t size)
+{
+    ssize_t get = socketIO == nullptr ? ::read(socketId, buffer, size) : socketIO->read(socketId, buffer, size);
+    Metrics::count(Metrics::SysCalls);
+    if (get > 0)
+    {
+        Metrics::count(Metrics::BytesIn, get);
+    }
+    return get;
+}
+
+inline ssize_t BaseSocket::ioWrite(char const* buffer, std::size_t size)
+{
+    ssize_t put = socketIO == nullptr ? ::write(socketId, buffer, size) : socketIO->write(socketId, buffer, size);
+    Metrics::count(Metrics::SysCalls);
+    if (put > 0)
+    {
+        Metrics::count(Metrics::BytesOut, put);
+    }
+    return put;
+}
+
+inline ssize_t BaseSocket::ioWritev(struct iovec const* data, int count, bool more)
+{
+    ssize_t put;
+    if (socketIO != nullptr)
+    {
+        put = socketIO->writev(socketId, data, count, more ? MSG_MORE : 0);
+    }
+    else if (!more)
+    {
+        put = ::writev(socketId, data, count);
+    }
+    else
+    {
+        // writev() has no flags.
+        msghdr  message{};
+        message.msg_iov     = const_cast<iovec*>(data);
+        message.msg_iovlen  = count;
+        put = ::sendmsg(socketId, &message, MSG_MORE);
+    }
+    Metrics::count(Metrics::SysCalls);
+    if (put > 0)
+    {
+        Metrics::count(Metrics::BytesOut, put);
+    }
+    return put;
+}
+
 template<typename F>
 std::size_t DataSocket::getMessageData(char* buffer, std::size_t size, F scanForEnd)
 {
@@ -18,11 +70,12 @@ std::size_t DataSocket::getMessageData(char* buffer, std::size_t size, F scanFor
         throw std::logic_error(buildErrorMessage("DataSocket::", __func__, ": accept called on a bad socket object (this object was moved)"));
     }
 
+    Trace::Scope    trace(Trace::Read, getSocketId());
     std::size_t     dataRead  = 0;
     while(dataRead < size)
     {
         // The inner loop handles interactions with the socket.
-        std::size_t get = read(getSocketId(), buffer + dataRead, size - dataRead);
+        std::size_t get = ioRead(buffer + dataRead, size - dataRead);
         if (get == static_cast<std::size_t>(-1))
         {
             switch(errno)
@@ -33,6 +86,7 @@ std::size_t DataSocket::getMessageData(char* buffer, std::size_t size, F scanFor
                 case ENXIO:
                 {
                     // Fatal error. Programming bug
+                    Metrics::count(Metrics::DomainErrors);
                     throw std::domain_error(buildErrorMessage("DataSocket::", __func__, ": read: critical error: ", strerror(errno)));
                 }
                 case EIO:
@@ -40,6 +94,7 @@ std::size_t DataSocket::getMessageData(char* buffer, std::size_t size, F scanFor
                 case ENOMEM:
                 {
                    // Resource acquisition failure or device error
+                    Metrics::count(Metrics::RuntimeErrors);
                     throw std::runtime_error(buildErrorMessage("DataSocket::", __func__, ": read: resource failure: ", strerror(errno)));
                 }
                 case EINTR:
@@ -47,12 +102,18 @@ std::size_t DataSocket::getMessageData(char* buffer, std::size_t size, F scanFor
                     //       Beyond the scope of this project
                     //       so continue normal operations.
                 case ETIMEDOUT:
-                case EAGAIN:
                 {
                     // Temporary error.
                     // Simply retry the read.
                     continue;
                 }
+                case EAGAIN:
+                {
+                    // Non-blocking socket with no data available.
+                    // Let something else run until there is data then retry the read.
+                    yieldRead();
+                    continue;
+                }
                 case ECONNRESET:
                 case ENOTCONN:
                 {
@@ -64,6 +125,7 @@ std::size_t DataSocket::getMessageData(char* buffer, std::size_t size, F scanFor
                 }
                 default:
                 {
+                    Metrics::count(Metrics::RuntimeErrors);
                     throw std::runtime_error(buildErrorMessage("DataSocket::", __func__, ": read: returned -1: ", strerror(errno)));
                 }
             }
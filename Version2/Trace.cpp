@@ -0,0 +1,263 @@
+
+#include "Trace.h"
+#include "Utility.h"
+#include <chrono>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <thread>
+#include <vector>
+#include <algorithm>
+#include <stdexcept>
+#include <cerrno>
+#include <csignal>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+
+using namespace ThorsAnvil::Socket;
+
+std::atomic<unsigned int>   Trace::sampleRate(0);
+
+namespace
+{
+    using Clock = std::chrono::steady_clock;
+
+    // Written by the owning thread and read by dump() while it is written.
+    // So every field is atomic (relaxed loads/stores are plain moves).
+    // `sequence` is a seqlock: the number of the event in the slot plus one
+    // (0 while it is being overwritten) so dump() can skip torn events.
+    struct Event
+    {
+        std::atomic<std::uint64_t>  sequence;
+        std::atomic<std::uint64_t>  start;
+        std::atomic<std::uint64_t>  end;
+        std::atomic<std::uint64_t>  info;       // point << 32 | id
+    };
+    struct Ring
+    {
+        std::atomic<std::uint64_t>  next{0};
+        std::uint64_t               first = 0;  // The first event since enable().
+        bool                        inUse = false;
+        Event                       events[Trace::ringSize];
+    };
+    struct Registry
+    {
+        std::mutex                          mutex;
+        std::vector<std::unique_ptr<Ring>>  rings;
+        // TSC and clock at enable() so ticks can be converted to time.
+        std::uint64_t                       baseTicks = 0;
+        Clock::time_point                   baseTime;
+    };
+    Registry& registry()
+    {
+        // Never destroyed: threads may exit after main() returns.
+        static Registry* registry = new Registry;
+        return *registry;
+    }
+
+    // A thread's ring. Taken on the first event the thread records and
+    // given back (to be reused by another thread) when the thread exits.
+    // The events stay in the ring until they are overwritten.
+    struct RingHolder
+    {
+        Ring*   ring;
+        RingHolder()
+        {
+            Registry&                   all = registry();
+            std::lock_guard<std::mutex> lock(all.mutex);
+            auto find = std::find_if(std::begin(all.rings), std::end(all.rings), [](auto const& ring){return !ring->inUse;});
+            if (find == std::end(all.rings))
+            {
+                all.rings.emplace_back(std::make_unique<Ring>());
+                find = std::end(all.rings) - 1;
+            }
+            ring        = find->get();
+            ring->inUse = true;
+        }
+        ~RingHolder()
+        {
+            Registry&                   all = registry();
+            std::lock_guard<std::mutex> lock(all.mutex);
+            ring->inUse = false;
+        }
+    };
+
+    char const* const pointName[] = {"accept", "read", "parse", "write"};
+
+    int dumpSignalPipe[2] = {-1, -1};
+
+    extern "C" void dumpSignalHandler(int)
+    {
+        int     savedErrno = errno;
+        char    signal  = 1;
+        // Nothing can be done if the pipe is full (a dump is already pending).
+        [[maybe_unused]] ssize_t ignore = ::write(dumpSignalPipe[1], &signal, 1);
+        errno   = savedErrno;
+    }
+}
+
+void Trace::enable(unsigned int rate)
+{
+    Registry&                   all = registry();
+    std::lock_guard<std::mutex> lock(all.mutex);
+    all.baseTicks   = now();
+    all.baseTime    = Clock::now();
+    // Events from an earlier enable() are not dumped.
+    for(auto& ring: all.rings)
+    {
+        ring->first = ring->next.load(std::memory_order_relaxed);
+    }
+    sampleRate.store(std::max(rate, 1u), std::memory_order_relaxed);
+}
+
+void Trace::disable()
+{
+    sampleRate.store(0, std::memory_order_relaxed);
+}
+
+void Trace::record(Point point, int id, std::uint64_t start, std::uint64_t end)
+{
+    thread_local RingHolder holder;
+    Ring&           ring    = *holder.ring;
+    std::uint64_t   next    = ring.next.load(std::memory_order_relaxed);
+    Event&          event   = ring.events[next % ringSize];
+    event.sequence.store(0, std::memory_order_relaxed);
+    // The slot is marked invalid before any field changes.
+    std::atomic_thread_fence(std::memory_order_release);
+    event.start.store(start, std::memory_order_relaxed);
+    event.end.store(end, std::memory_order_relaxed);
+    event.info.store(static_cast<std::uint64_t>(point) << 32 | static_cast<std::uint32_t>(id), std::memory_order_relaxed);
+    // Publish the event.
+    event.sequence.store(next + 1, std::memory_order_release);
+    ring.next.store(next + 1, std::memory_order_release);
+}
+
+void Trace::dump(std::ostream& stream)
+{
+    Registry&                   all = registry();
+    std::lock_guard<std::mutex> lock(all.mutex);
+
+    // Work out the TSC rate from the time since enable().
+    // A short interval would give a poor estimate.
+    Clock::duration minimum = std::chrono::milliseconds(10);
+    if (Clock::now() - all.baseTime < minimum)
+    {
+        std::this_thread::sleep_for(minimum);
+    }
+    std::uint64_t   ticks   = now() - all.baseTicks;
+    double          micros  = std::chrono::duration<double, std::micro>(Clock::now() - all.baseTime).count();
+    double          perMicro = ticks / micros;
+
+    pid_t           pid     = ::getpid();
+    std::set<int>   ids;
+    char const*     separator = "";
+    std::ios_base::fmtflags flags = stream.flags();
+    std::streamsize         precision = stream.precision(3);
+    stream << std::fixed << "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[";
+    for(std::size_t thread = 0; thread < all.rings.size(); ++thread)
+    {
+        Ring const&     ring    = *all.rings[thread];
+        std::uint64_t   next    = ring.next.load(std::memory_order_acquire);
+        std::uint64_t   first   = std::max(ring.first, next < ringSize ? 0 : next - ringSize);
+        for(std::uint64_t loop = first; loop < next; ++loop)
+        {
+            Event const&    event   = ring.events[loop % ringSize];
+            std::uint64_t   before  = event.sequence.load(std::memory_order_acquire);
+            std::uint64_t   start   = event.start.load(std::memory_order_relaxed);
+            std::uint64_t   end     = event.end.load(std::memory_order_relaxed);
+            std::uint64_t   info    = event.info.load(std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_acquire);
+            std::uint64_t   after   = event.sequence.load(std::memory_order_relaxed);
+            int             id      = static_cast<std::int32_t>(info & 0xFFFFFFFF);
+            if (before != loop + 1 || after != loop + 1)
+            {
+                // The owner overwrote (or is overwriting) this slot while it was read.
+                continue;
+            }
+            if (start < all.baseTicks || end < start)
+            {
+                // Started before enable() (or the TSC went backwards: a different CPU).
+                continue;
+            }
+            ids.insert(id);
+            stream << separator
+                   << "{\"name\":\"" << pointName[info >> 32] << "\",\"cat\":\"socket\",\"ph\":\"X\""
+                   << ",\"ts\":"  << (start - all.baseTicks) / perMicro
+                   << ",\"dur\":" << (end - start) / perMicro
+                   << ",\"pid\":" << pid << ",\"tid\":" << id
+                   << ",\"args\":{\"thread\":" << thread << "}}";
+            separator = ",\n";
+        }
+    }
+    // Name the tracks.
+    for(int id: ids)
+    {
+        stream << separator
+               << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":" << pid << ",\"tid\":" << id
+               << ",\"args\":{\"name\":\"socket " << id << "\"}}";
+        separator = ",\n";
+    }
+    stream << "]}\n";
+    stream.flags(flags);
+    stream.precision(precision);
+}
+
+void Trace::dump(std::string const& fileName)
+{
+    std::ofstream   file(fileName);
+    dump(file);
+    if (!file)
+    {
+        throw std::runtime_error(buildErrorMessage("Trace::", __func__, ": Failed to write: ", fileName));
+    }
+}
+
+void Trace::dumpOnSignal(int signalNumber, std::string const& fileName)
+{
+    if (dumpSignalPipe[0] != -1)
+    {
+        throw std::logic_error(buildErrorMessage("Trace::", __func__, ": Already dumping on a signal"));
+    }
+    if (::pipe2(dumpSignalPipe, O_CLOEXEC | O_NONBLOCK) != 0)
+    {
+        throw std::runtime_error(buildErrorMessage("Trace::", __func__, ": pipe2: ", strerror(errno)));
+    }
+    // Only the write end is non-blocking (the handler must never block).
+    ::fcntl(dumpSignalPipe[0], F_SETFL, 0);
+
+    std::thread([fileName]()
+    {
+        char    signal;
+        while(true)
+        {
+            ssize_t get = ::read(dumpSignalPipe[0], &signal, 1);
+            if (get == -1 && errno == EINTR)
+            {
+                continue;
+            }
+            if (get != 1)
+            {
+                break;
+            }
+            try
+            {
+                dump(fileName);
+            }
+            catch(std::exception const&)
+            {
+                // TODO: LOGGING CODE HERE
+            }
+        }
+    }).detach();
+
+    struct sigaction    action{};
+    action.sa_handler   = dumpSignalHandler;
+    action.sa_flags     = SA_RESTART;
+    sigemptyset(&action.sa_mask);
+    if (::sigaction(signalNumber, &action, nullptr) != 0)
+    {
+        throw std::runtime_error(buildErrorMessage("Trace::", __func__, ": sigaction: ", strerror(errno)));
+    }
+}
@@ -0,0 +1,114 @@
+
+#ifndef THORSANVIL_SOCKET_TRACE_H
+#define THORSANVIL_SOCKET_TRACE_H
+
+#include <atomic>
+#include <string>
+#include <ostream>
+#include <cstdint>
+#include <cstddef>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#else
+#include <chrono>
+#endif
+
+namespace ThorsAnvil
+{
+    namespace Socket
+    {
+
+/*
+ * A sampling tracer for the hot path.
+ *
+ * A Trace::Scope records how long the enclosing block took:
+ *      Accept      ServerSocket::accept()      (including waiting for a connection)
+ *      Read        DataSocket::getMessageData() (including waiting for data)
+ *      Parse       Reading an HTTP request/response head (reads appear nested inside)
+ *      Write       DataSocket::putMessageData() (including waiting for buffer space)
+ *
+ * Timestamps are read from the TSC (rdtsc) and only converted to time when
+ * the trace is dumped. Each thread writes its events to its own ring buffer
+ * (the last `ringSize` are kept) so recording takes no lock.
+ *
+ * Disabled (the default) a Scope is a single relaxed load and a branch.
+ * Enabled, one Scope in every `sampleRate` is recorded.
+ *
+ * The events are dumped in the Chrome trace event format (JSON) which
+ * chrome://tracing and Perfetto load. Each connection (socket id) is shown
+ * as its own track so the stages of a request are seen one after another.
+ */
+class Trace
+{
+    public:
+        enum Point {Accept, Read, Parse, Write, PointCount};
+        static constexpr std::size_t ringSize = 1 << 14;
+
+        class Scope
+        {
+            std::uint64_t   start;
+            Point           point;
+            int             id;
+            public:
+                Scope(Point point, int id)
+                    : start(0)
+                    , point(point)
+                    , id(id)
+                {
+                    if (sampleRate.load(std::memory_order_relaxed) != 0 && sample())
+                    {
+                        start = now();
+                    }
+                }
+                ~Scope()
+                {
+                    if (start != 0)
+                    {
+                        record(point, id, start, now());
+                    }
+                }
+                Scope(Scope const&)             = delete;
+                Scope& operator=(Scope const&)  = delete;
+        };
+
+        // Record one in every `rate` scopes (1 records everything).
+        static void enable(unsigned int rate = 1);
+        static void disable();
+        static bool enabled()   {return sampleRate.load(std::memory_order_relaxed) != 0;}
+
+        // Write the events recorded so far as Chrome trace JSON.
+        static void dump(std::ostream& stream);
+        static void dump(std::string const& fileName);
+        // Dump to `fileName` each time the process receives `signalNumber`.
+        // The handler only writes to a pipe; a background thread does the dump.
+        static void dumpOnSignal(int signalNumber, std::string const& fileName);
+
+    private:
+        static std::atomic<unsigned int>    sampleRate;
+
+        static std::uint64_t now()
+        {
+#if defined(__x86_64__) || defined(__i386__)
+            return __rdtsc();
+#else
+            return std::chrono::steady_clock::now().time_since_epoch().count();
+#endif
+        }
+        static bool sample()
+        {
+            thread_local unsigned int   countdown = 0;
+            if (countdown == 0)
+            {
+                countdown = sampleRate.load(std::memory_order_relaxed) - 1;
+                return true;
+            }
+            --countdown;
+            return false;
+        }
+        static void record(Point point, int id, std::uint64_t start, std::uint64_t end);
+};
+
+    }
+}
+
+#endif
@@ -0,0 +1,242 @@
+
+#include "URing.h"
+#include "Utility.h"
+#include <stdexcept>
+#include <cstring>
+#include <cerrno>
+#include <cstdint>
+#include <memory>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+using namespace ThorsAnvil::Socket;
+
+namespace
+{
+    int ioURingSetup(unsigned entries, io_uring_params* params)
+    {
+        return ::syscall(__NR_io_uring_setup, entries, params);
+    }
+    int ioURingEnter(int ringId, unsigned submit, unsigned waitFor, unsigned flags)
+    {
+        return ::syscall(__NR_io_uring_enter, ringId, submit, waitFor, flags, nullptr, 0);
+    }
+    int ioURingRegister(int ringId, unsigned opcode, void* arg, unsigned count)
+    {
+        return ::syscall(__NR_io_uring_register, ringId, opcode, arg, count);
+    }
+    template<typename T>
+    T* ringPointer(void* ring, unsigned offset)
+    {
+        return reinterpret_cast<T*>(static_cast<char*>(ring) + offset);
+    }
+}
+
+URing::URing(unsigned entries)
+    : ringId(-1)
+    , sqRing(MAP_FAILED)
+    , sqes(static_cast<io_uring_sqe*>(MAP_FAILED))
+    , sqPending(0)
+    , cqRing(MAP_FAILED)
+{
+    io_uring_params     params{};
+    ringId = ioURingSetup(entries, &params);
+    if (ringId == -1)
+    {
+        throw std::runtime_error(buildErrorMessage("URing::", __func__, ": io_uring_setup: ", strerror(errno)));
+    }
+
+    sqRingSize  = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    cqRingSize  = params.cq_off.cqes  + params.cq_entries * sizeof(io_uring_cqe);
+    sqesSize    = params.sq_entries * sizeof(io_uring_sqe);
+    sqRing      = ::mmap(nullptr, sqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringId, IORING_OFF_SQ_RING);
+    cqRing      = ::mmap(nullptr, cqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringId, IORING_OFF_CQ_RING);
+    void* sqe   = ::mmap(nullptr, sqesSize,   PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringId, IORING_OFF_SQES);
+    sqes        = static_cast<io_uring_sqe*>(sqe);
+    if (sqRing == MAP_FAILED || cqRing == MAP_FAILED || sqe == MAP_FAILED)
+    {
+        int error = errno;
+        release();
+        throw std::runtime_error(buildErrorMessage("URing::", __func__, ": mmap: ", strerror(error)));
+    }
+
+    sqHead      = ringPointer<unsigned>(sqRing, params.sq_off.head);
+    sqTail      = ringPointer<unsigned>(sqRing, params.sq_off.tail);
+    sqLocalTail = *sqTail;
+    sqMask      = ringPointer<unsigned>(sqRing, params.sq_off.ring_mask);
+    sqArray     = ringPointer<unsigned>(sqRing, params.sq_off.array);
+    sqEntries   = params.sq_entries;
+    cqHead      = ringPointer<unsigned>(cqRing, params.cq_off.head);
+    cqTail      = ringPointer<unsigned>(cqRing, params.cq_off.tail);
+    cqMask      = ringPointer<unsigned>(cqRing, params.cq_off.ring_mask);
+    cqes        = ringPointer<io_uring_cqe>(cqRing, params.cq_off.cqes);
+}
+
+URing::~URing()
+{
+    release();
+}
+
+void URing::release()
+{
+    if (sqes != MAP_FAILED)
+    {
+        ::munmap(sqes, sqesSize);
+    }
+    if (cqRing != MAP_FAILED)
+    {
+        ::munmap(cqRing, cqRingSize);
+    }
+    if (sqRing != MAP_FAILED)
+    {
+        ::munmap(sqRing, sqRingSize);
+    }
+    if (ringId != -1)
+    {
+        ::close(ringId);
+    }
+}
+
+bool URing::isSupported()
+{
+    // io_uring may be missing (old kernel) or disabled (sysctl/seccomp).
+    // Kernels before 5.19 have io_uring but not everything the EventLoop
+    // needs. The sparse tables are tried for real as there is no probe for
+    // them; multishot accept arrived in the same release.
+    static bool const supported = []()
+    {
+        try
+        {
+            URing   ring(1);
+            ring.registerFiles(1);
+            ring.registerBuffers(1);
+            return ring.supportsOps({IORING_OP_NOP, IORING_OP_READ, IORING_OP_READ_FIXED, IORING_OP_RECV,
+                                     IORING_OP_SEND, IORING_OP_WRITEV, IORING_OP_SENDMSG, IORING_OP_ACCEPT,
+                                     IORING_OP_POLL_ADD, IORING_OP_ASYNC_CANCEL, IORING_OP_TIMEOUT});
+        }
+        catch(std::exception const&)
+        {
+            return false;
+        }
+    }();
+    return supported;
+}
+
+bool URing::supportsOps(std::initializer_list<unsigned char> ops)
+{
+    // io_uring_probe ends with a variable sized array of ops.
+    static constexpr unsigned   probeOps    = 256;
+    std::unique_ptr<char[]>     buffer(new char[sizeof(io_uring_probe) + probeOps * sizeof(io_uring_probe_op)]());
+    io_uring_probe*             probe       = reinterpret_cast<io_uring_probe*>(buffer.get());
+    if (ioURingRegister(ringId, IORING_REGISTER_PROBE, probe, probeOps) < 0)
+    {
+        return false;
+    }
+    for(unsigned char op: ops)
+    {
+        if (op > probe->last_op || (probe->ops[op].flags & IO_URING_OP_SUPPORTED) == 0)
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+io_uring_sqe& URing::getSqe()
+{
+    if (sqPending == sqEntries)
+    {
+        submit(0);
+    }
+    unsigned        index   = sqLocalTail & *sqMask;
+    io_uring_sqe&   sqe     = sqes[index];
+    std::memset(&sqe, 0, sizeof(sqe));
+
+    sqArray[index] = index;
+    // The tail the kernel reads is moved by submit() (once the caller has filled in the sqe).
+    ++sqLocalTail;
+    ++sqPending;
+    return sqe;
+}
+
+void URing::submit(unsigned waitFor)
+{
+    // Release: The sqes must be visible before the kernel sees the new tail.
+    __atomic_store_n(sqTail, sqLocalTail, __ATOMIC_RELEASE);
+    int submitted = enter(sqPending, waitFor);
+    if (submitted >= 0)
+    {
+        // Anything not taken by the kernel is still in the queue
+        // and will be picked up by the next call.
+        sqPending -= submitted;
+        return;
+    }
+    switch(errno)
+    {
+        case EINTR:
+            // Interrupted while waiting.
+            // The caller will check for completions and call again.
+            return;
+        case EAGAIN:
+        case EBUSY:
+            // The completion queue is full.
+            // The caller needs to process completions before we can submit more.
+            if (waitFor != 0)
+            {
+                return;
+            }
+            throw std::runtime_error(buildErrorMessage("URing::", __func__, ": io_uring_enter: completion queue full"));
+        default:
+            throw std::runtime_error(buildErrorMessage("URing::", __func__, ": io_uring_enter: ", strerror(errno)));
+    }
+}
+
+int URing::enter(unsigned submit, unsigned waitFor)
+{
+    return ioURingEnter(ringId, submit, waitFor, waitFor == 0 ? 0 : IORING_ENTER_GETEVENTS);
+}
+
+void URing::registerResource(unsigned opcode, void* arg, unsigned count, char const* func)
+{
+    if (ioURingRegister(ringId, opcode, arg, count) < 0)
+    {
+        throw std::runtime_error(buildErrorMessage("URing::", func, ": io_uring_register: ", strerror(errno)));
+    }
+}
+
+void URing::registerFiles(unsigned count)
+{
+    io_uring_rsrc_register  files{};
+    files.nr        = count;
+    files.flags     = IORING_RSRC_REGISTER_SPARSE;
+    registerResource(IORING_REGISTER_FILES2, &files, sizeof(files), __func__);
+}
+
+void URing::updateFile(unsigned slot, int fileId)
+{
+    io_uring_rsrc_update2   update{};
+    update.offset   = slot;
+    update.data     = reinterpret_cast<std::uintptr_t>(&fileId);
+    update.nr       = 1;
+    registerResource(IORING_REGISTER_FILES_UPDATE2, &update, sizeof(update), __func__);
+}
+
+void URing::registerBuffers(unsigned count)
+{
+    io_uring_rsrc_register  buffers{};
+    buffers.nr      = count;
+    buffers.flags   = IORING_RSRC_REGISTER_SPARSE;
+    registerResource(IORING_REGISTER_BUFFERS2, &buffers, sizeof(buffers), __func__);
+}
+
+void URing::updateBuffer(unsigned slot, void* buffer, std::size_t size)
+{
+    iovec                   data{buffer, size};
+    io_uring_rsrc_update2   update{};
+    update.offset   = slot;
+    update.data     = reinterpret_cast<std::uintptr_t>(&data);
+    update.nr       = 1;
+    registerResource(IORING_REGISTER_BUFFERS_UPDATE, &update, sizeof(update), __func__);
+}
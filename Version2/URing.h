@@ -0,0 +1,108 @@
+
+#ifndef THORSANVIL_SOCKET_URING_H
+#define THORSANVIL_SOCKET_URING_H
+
+#include <linux/io_uring.h>
+#include <cstddef>
+#include <initializer_list>
+
+struct iovec;
+
+namespace ThorsAnvil
+{
+    namespace Socket
+    {
+
+// A minimal wrapper around an io_uring instance.
+//
+// Uses the system calls directly (so there is no dependency on liburing).
+// Requests are queued with getSqe() and are not passed to the kernel
+// until submit() is called. So all the work queued by one pass of an
+// event loop is sent with a single io_uring_enter().
+class URing
+{
+    int                 ringId;
+
+    // Submission Queue
+    void*               sqRing;
+    std::size_t         sqRingSize;
+    unsigned*           sqHead;
+    unsigned*           sqTail;
+    unsigned            sqLocalTail;    // Includes requests not yet published to the kernel.
+    unsigned*           sqMask;
+    unsigned*           sqArray;
+    unsigned            sqEntries;
+    io_uring_sqe*       sqes;
+    std::size_t         sqesSize;
+    unsigned            sqPending;
+
+    // Completion Queue
+    void*               cqRing;
+    std::size_t         cqRingSize;
+    unsigned*           cqHead;
+    unsigned*           cqTail;
+    unsigned*           cqMask;
+    io_uring_cqe*       cqes;
+
+    void release();
+    int  enter(unsigned submit, unsigned waitFor);
+    void registerResource(unsigned opcode, void* arg, unsigned count, char const* func);
+    bool supportsOps(std::initializer_list<unsigned char> ops);
+
+    public:
+        URing(unsigned entries);
+        ~URing();
+        URing(URing const&)             = delete;
+        URing& operator=(URing const&)  = delete;
+
+        // True if the kernel supports io_uring with everything the EventLoop uses:
+        // its opcodes, sparse fixed file/buffer tables and multishot accept (5.19+).
+        static bool isSupported();
+
+        // An empty request to be filled in by the caller.
+        // If the submission queue is full the queued requests are submitted first.
+        // Note: The kernel does not see the request until submit().
+        io_uring_sqe&   getSqe();
+
+        // Pass all queued requests to the kernel and wait until
+        // at least `waitFor` requests have completed.
+        void            submit(unsigned waitFor);
+
+        // Call `action(cqe)` for every completed request.
+        // Returns the number of completions processed.
+        template<typename F>
+        std::size_t     processCompletions(F&& action);
+
+        // Fixed files: a table of `count` slots (initially empty).
+        // Requests with IOSQE_FIXED_FILE use the slot number instead of the fd.
+        void            registerFiles(unsigned count);
+        void            updateFile(unsigned slot, int fileId);      // -1 clears the slot
+
+        // Fixed buffers: a table of `count` slots (initially empty).
+        // IORING_OP_READ_FIXED can only read into a registered buffer.
+        void            registerBuffers(unsigned count);
+        void            updateBuffer(unsigned slot, void* buffer, std::size_t size);    // nullptr clears the slot
+};
+
+template<typename F>
+std::size_t URing::processCompletions(F&& action)
+{
+    std::size_t count   = 0;
+    unsigned    head    = *cqHead;
+    // Acquire: The cqe entries are written by the kernel before it moves the tail.
+    unsigned    tail    = __atomic_load_n(cqTail, __ATOMIC_ACQUIRE);
+    for(; head != tail; ++head, ++count)
+    {
+        // Copy the entry so the slot can be released before `action`
+        // runs (it may queue more work which can complete into this slot).
+        io_uring_cqe    cqe = cqes[head & *cqMask];
+        __atomic_store_n(cqHead, head + 1, __ATOMIC_RELEASE);
+        action(cqe);
+    }
+    return count;
+}
+
+    }
+}
+
+#endif
@@ -1,10 +1,13 @@
-
 #ifndef THORSANVIL_SOCKET_UTILITY_H
 #define THORSANVIL_SOCKET_UTILITY_H
 
 #include <string>
+#include <string_view>
 #include <sstream>
 #include <utility>
+#include <type_traits>
+#include <charconv>
+#include <cstring>
 #include <cstddef>
 
 namespace ThorsAnvil
@@ -19,12 +22,92 @@ int print(std::ostream& s, Args&... args)
     return Expander{ 0, ((s << std::forward<Args>(args)), 0)...}[0];
 }
 
+/*
+ * String building without streams.
+ *
+ * The parts can be strings (char const*, std::string, std::string_view),
+ * single characters or integers. The exact size of the result is worked
+ * out first so the output is written in one pass with no reallocation.
+ * Integers are formatted with std::to_chars().
+ */
+namespace StringPart
+{
+    inline std::size_t size(char const* part)               {return std::strlen(part);}
+    inline std::size_t size(std::string const& part)        {return part.size();}
+    inline std::size_t size(std::string_view part)          {return part.size();}
+    inline std::size_t size(char)                           {return 1;}
+
+    template<typename T>
+    std::enable_if_t<std::is_integral_v<T> && !std::is_same_v<T, bool>, std::size_t> size(T part)
+    {
+        std::size_t digits = 1;
+        // Work with the magnitude as an unsigned value (so the minimum value does not overflow).
+        std::make_unsigned_t<T> value = part;
+        if constexpr (std::is_signed_v<T>)
+        {
+            if (part < 0)
+            {
+                digits  = 2;
+                value   = -value;
+            }
+        }
+        for(; value >= 10; value /= 10)
+        {
+            ++digits;
+        }
+        return digits;
+    }
+
+    inline char* write(char* out, char const* part)         {std::size_t s = std::strlen(part); std::memcpy(out, part, s); return out + s;}
+    inline char* write(char* out, std::string const& part)  {std::memcpy(out, part.data(), part.size()); return out + part.size();}
+    inline char* write(char* out, std::string_view part)    {std::memcpy(out, part.data(), part.size()); return out + part.size();}
+    inline char* write(char* out, char part)                {*out = part; return out + 1;}
+
+    template<typename T>
+    std::enable_if_t<std::is_integral_v<T> && !std::is_same_v<T, bool>, char*> write(char* out, T part)
+    {
+        // The caller has made space for size(part) characters.
+        return std::to_chars(out, out + size(part), part).ptr;
+    }
+}
+
+// The exact number of characters needed by the parts.
+template<typename... Args>
+std::size_t stringPartsSize(Args const&... args)
+{
+    return (std::size_t{0} + ... + StringPart::size(args));
+}
+
+// Write the parts to the caller provided buffer [begin, end).
+// Returns the end of the data written or nullptr if it does not fit
+// (in which case nothing is written).
+template<typename... Args>
+char* buildStringInto(char* begin, char* end, Args const&... args)
+{
+    if (stringPartsSize(args...) > static_cast<std::size_t>(end - begin))
+    {
+        return nullptr;
+    }
+    ((begin = StringPart::write(begin, args)), ...);
+    return begin;
+}
+
+// Append the parts to `output` (a single resize at most).
+template<typename... Args>
+void appendStringParts(std::string& output, Args const&... args)
+{
+    std::size_t start = output.size();
+    output.resize(start + stringPartsSize(args...));
+    char* out = &output[start];
+    ((out = StringPart::write(out, args)), ...);
+}
+
 template<typename... Args>
 std::string buildStringFromParts(Args const&... args)
 {
-    std::stringstream msg;
-    print(msg, args...);
-    return msg.str();
+    std::string result;
+    appendStringParts(result, args...);
+    return result;
 }
 
 template<typename... Args>
@@ -37,4 +120,3 @@ std::string buildErrorMessage(Args const&... args)
 }
 
 #endif
-
@@ -0,0 +1,55 @@
+
+#include "WorkerPool.h"
+#include "Socket.h"
+#include <thread>
+#include <vector>
+#include <algorithm>
+#include <iostream>
+
+using namespace ThorsAnvil::Socket;
+
+WorkerPool::WorkerPool(int port, EventLoop::Handler handler, int workerCount, EventLoop::Backend backend)
+    : port(port)
+    , workerCount(workerCount)
+    , handler(std::move(handler))
+    , backend(backend)
+{
+    if (this->workerCount <= 0)
+    {
+        // hardware_concurrency() is allowed to return 0 when unknown.
+        this->workerCount = std::max(1u, std::thread::hardware_concurrency());
+    }
+}
+
+void WorkerPool::run()
+{
+    // Open all the listeners before starting any threads.
+    // So that a failure to bind is reported to the caller.
+    std::vector<ServerSocket>   servers;
+    for(int loop = 0; loop < workerCount; ++loop)
+    {
+        servers.emplace_back(port, true);
+    }
+
+    std::vector<std::thread>    workers;
+    for(auto& server: servers)
+    {
+        workers.emplace_back([this, &server]()
+        {
+            try
+            {
+                EventLoop   loop(backend);
+                loop.listen(server, handler);
+                loop.run();
+            }
+            catch(std::exception const& e)
+            {
+                std::cerr << "WorkerPool: worker failed: " << e.what() << "\n";
+            }
+        });
+    }
+    for(auto& worker: workers)
+    {
+        worker.join();
+    }
+}
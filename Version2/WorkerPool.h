@@ -0,0 +1,37 @@
+
+#ifndef THORSANVIL_SOCKET_WORKER_POOL_H
+#define THORSANVIL_SOCKET_WORKER_POOL_H
+
+#include "EventLoop.h"
+
+namespace ThorsAnvil
+{
+    namespace Socket
+    {
+
+// Runs a server on multiple threads.
+//
+// Each worker thread has its own ServerSocket (opened with SO_REUSEPORT)
+// and its own EventLoop. The kernel spreads incoming connections across
+// the listeners so the workers share nothing and need no locking.
+class WorkerPool
+{
+    int                 port;
+    int                 workerCount;
+    EventLoop::Handler  handler;
+    EventLoop::Backend  backend;
+
+    public:
+        // A `workerCount` of 0 means one worker per core.
+        WorkerPool(int port, EventLoop::Handler handler, int workerCount = 0, EventLoop::Backend backend = EventLoop::Backend::Best);
+
+        int  getWorkerCount() const {return workerCount;}
+
+        // Start the workers and wait for them to finish.
+        void run();
+};
+
+    }
+}
+
+#endif
@@ -0,0 +1,35 @@
+#include "Socket.h"
+#include "Async.h"
+#include "AsyncProtocolSimple.h"
+#include <iostream>
+
+namespace Sock = ThorsAnvil::Socket;
+
+Sock::Async<void> handle(Sock::AsyncLoop& loop, Sock::DataSocket accept)
+{
+    Sock::AsyncSocket           socket(loop, std::move(accept));
+    Sock::AsyncProtocolSimple   acceptSimple(socket);
+
+    std::string message;
+    co_await acceptSimple.recvMessage(message);
+    std::cout << message << "\n";
+
+    co_await acceptSimple.sendMessage("", "OK");
+}
+
+Sock::Async<void> listen(Sock::AsyncLoop& loop, Sock::AsyncServerSocket& server)
+{
+    while(true)
+    {
+        loop.spawn(handle(loop, co_await server.accept()));
+    }
+}
+
+int main()
+{
+    Sock::AsyncLoop          loop;
+    Sock::AsyncServerSocket  server(loop, 8080);
+
+    loop.spawn(listen(loop, server));
+    loop.run();
+}
@@ -0,0 +1,25 @@
+
+#include "Socket.h"
+#include "ProtocolSimple.h"
+#include "EventLoop.h"
+#include <iostream>
+
+namespace Sock = ThorsAnvil::Socket;
+
+int main()
+{
+    Sock::ServerSocket   server(8080);
+    Sock::EventLoop      loop;
+
+    loop.listen(server, [](Sock::DataSocket& accept)
+    {
+        Sock::ProtocolSimple acceptSimple(accept);
+
+        std::string message;
+        acceptSimple.recvMessage(message);
+        std::cout << message << "\n";
+
+        acceptSimple.sendMessage("", "OK");
+    });
+    loop.run();
+}
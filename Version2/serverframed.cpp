@@ -0,0 +1,40 @@
+#include "Socket.h"
+#include "ProtocolFramed.h"
+#include "WorkerPool.h"
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+
+namespace Sock = ThorsAnvil::Socket;
+
+int main(int argc, char* argv[])
+{
+    if (argc > 3 || (argc == 3 && std::strcmp(argv[2], "epoll") != 0 && std::strcmp(argv[2], "uring") != 0))
+    {
+        std::cerr << "Usage: serverframed [<workers> [epoll|uring]]\n";
+        std::exit(1);
+    }
+    // By default io_uring is used when the kernel supports it.
+    Sock::EventLoop::Backend backend = Sock::EventLoop::Backend::Best;
+    if (argc == 3)
+    {
+        backend = std::strcmp(argv[2], "epoll") == 0 ? Sock::EventLoop::Backend::Epoll : Sock::EventLoop::Backend::URing;
+    }
+
+    Sock::WorkerPool     server(8080, [](Sock::DataSocket& accept)
+    {
+        Sock::ProtocolFramed acceptFramed(accept);
+
+        // The connection stays open: answer each request until the client closes it.
+        // The client may have several requests in flight (they are answered in order).
+        std::string message;
+        while (acceptFramed.hasMessage())
+        {
+            acceptFramed.recvMessage(message);
+            acceptFramed.sendResponse(acceptFramed.getFrame().streamId, "OK");
+        }
+    }, argc >= 2 ? std::atoi(argv[1]) : 0, backend);
+
+    std::cout << "Workers: " << server.getWorkerCount() << "\n";
+    server.run();
+}
@@ -0,0 +1,39 @@
+
+#include "Socket.h"
+#include "ProtocolSimple.h"
+#include "WorkerPool.h"
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+
+namespace Sock = ThorsAnvil::Socket;
+
+int main(int argc, char* argv[])
+{
+    if (argc > 3 || (argc == 3 && std::strcmp(argv[2], "epoll") != 0 && std::strcmp(argv[2], "uring") != 0))
+    {
+        std::cerr << "Usage: serverthreaded [<workers> [epoll|uring]]\n";
+        std::exit(1);
+    }
+    // By default io_uring is used when the kernel supports it.
+    Sock::EventLoop::Backend backend = Sock::EventLoop::Backend::Best;
+    if (argc == 3)
+    {
+        backend = std::strcmp(argv[2], "epoll") == 0 ? Sock::EventLoop::Backend::Epoll : Sock::EventLoop::Backend::URing;
+    }
+
+    Sock::WorkerPool     server(8080, [](Sock::DataSocket& accept)
+    {
+        Sock::ProtocolSimple acceptSimple(accept);
+
+        // Note: Messages are not printed. A shared std::cout
+        //       would serialize the workers.
+        std::string message;
+        acceptSimple.recvMessage(message);
+
+        acceptSimple.sendMessage("", "OK");
+    }, argc >= 2 ? std::atoi(argv[1]) : 0, backend);
+
+    std::cout << "Workers: " << server.getWorkerCount() << "\n";
+    server.run();
+}
@@ -0,0 +1,62 @@
+
+#include "HTTPDate.h"
+#include <cstring>
+#include <time.h>
+
+using namespace ThorsAnvil::Socket;
+
+HTTPDate::HTTPDate()
+    : current(-1)
+{}
+
+char const* HTTPDate::get()
+{
+    // The coarse clock is read without a system call (vDSO)
+    // and is accurate enough for a value with one second resolution.
+    timespec    clock;
+    ::clock_gettime(CLOCK_REALTIME_COARSE, &clock);
+    if (clock.tv_sec != current)
+    {
+        format(clock.tv_sec);
+    }
+    return value;
+}
+
+/*
+ * Built by hand rather than strftime() so the output
+ * does not depend on the locale.
+ */
+void HTTPDate::format(std::time_t now)
+{
+    static char const days[][4]     = {"Sun", "Mon", "Tue", "Wed", "Thu", "Fri", "Sat"};
+    static char const months[][4]   = {"Jan", "Feb", "Mar", "Apr", "May", "Jun", "Jul", "Aug", "Sep", "Oct", "Nov", "Dec"};
+
+    auto twoDigits = [](char* dst, int value)
+    {
+        dst[0] = '0' + value / 10;
+        dst[1] = '0' + value % 10;
+    };
+
+    std::tm     tm;
+    ::gmtime_r(&now, &tm);
+
+    //                 0         1         2
+    //                 01234567890123456789012345678
+    std::memcpy(value, "Sun, 06 Nov 1994 08:49:37 GMT", size + 1);
+    std::memcpy(value, days[tm.tm_wday], 3);
+    twoDigits(value + 5, tm.tm_mday);
+    std::memcpy(value + 8, months[tm.tm_mon], 3);
+    twoDigits(value + 12, (tm.tm_year + 1900) / 100);
+    twoDigits(value + 14, (tm.tm_year + 1900) % 100);
+    twoDigits(value + 17, tm.tm_hour);
+    twoDigits(value + 20, tm.tm_min);
+    twoDigits(value + 23, tm.tm_sec);
+
+    current = now;
+}
+
+char const* HTTPDate::now()
+{
+    thread_local HTTPDate   date;
+    return date.get();
+}
@@ -0,0 +1,42 @@
+
+#ifndef THORSANVIL_SOCKET_HTTP_DATE_H
+#define THORSANVIL_SOCKET_HTTP_DATE_H
+
+#include <ctime>
+#include <cstddef>
+
+namespace ThorsAnvil
+{
+    namespace Socket
+    {
+
+// The current time formatted for the HTTP "Date:" header (RFC 7231 7.1.1.1)
+//      Sun, 06 Nov 1994 08:49:37 GMT
+//
+// Formatting the date on every response is expensive (localtime() takes
+// a lock and put_time() goes through a stream). As the value only changes
+// once a second it is cached and only rebuilt when the second changes.
+// The cache is per thread so no locking is needed.
+class HTTPDate
+{
+    public:
+        static constexpr std::size_t size = 29;
+    private:
+        std::time_t     current;
+        char            value[size + 1];
+
+        void format(std::time_t now);
+    public:
+        HTTPDate();
+
+        // The current date (`size` characters and null terminated).
+        char const* get();
+
+        // The cached date for the current thread.
+        static char const* now();
+};
+
+    }
+}
+
+#endif
@@ -0,0 +1,115 @@
+
+#ifndef THORSANVIL_SOCKET_HTTP_MESSAGE_VIEW_H
+#define THORSANVIL_SOCKET_HTTP_MESSAGE_VIEW_H
+
+#include "HTTPScanner.h"
+#include <array>
+#include <string_view>
+#include <stdexcept>
+
+namespace ThorsAnvil
+{
+    namespace Socket
+    {
+
+struct HTTPHeader
+{
+    std::string_view    name;
+    std::string_view    value;
+};
+
+// A read only view of the head of the last message received.
+//
+// All the values point directly into the protocol's input buffer so
+// filling the view needs no memory allocation. As a result the values
+// are only valid until the next call to hasMessage() or recvMessage().
+//
+// For a request (read by HTTPServer) the method, url and version are set.
+// For a response (read by HTTPClient) the version, status and reason are set.
+class HTTPMessageView
+{
+    public:
+        static constexpr std::size_t maxHeaders = 64;
+        using Headers = std::array<HTTPHeader, maxHeaders>;
+    private:
+        std::string_view    method;
+        std::string_view    url;
+        std::string_view    version;
+        int                 status;
+        std::string_view    reason;
+        Headers             headers;
+        std::size_t         headerCount;
+
+    public:
+        HTTPMessageView()
+            : status(0)
+            , headerCount(0)
+        {}
+
+        void clear()
+        {
+            method      = url = version = reason = std::string_view();
+            status      = 0;
+            headerCount = 0;
+        }
+        void setRequest(std::string_view m, std::string_view u, std::string_view v)
+        {
+            method      = m;
+            url         = u;
+            version     = v;
+        }
+        void setResponse(std::string_view v, int s, std::string_view r)
+        {
+            version     = v;
+            status      = s;
+            reason      = r;
+        }
+        void addHeader(std::string_view name, std::string_view value)
+        {
+            if (headerCount == maxHeaders)
+            {
+                throw HTTPParseError("HTTPMessageView::addHeader: Too many headers");
+            }
+            headers[headerCount++] = {name, value};
+        }
+
+        std::string_view    getMethod()     const   {return method;}
+        std::string_view    getUrl()        const   {return url;}
+        std::string_view    getVersion()    const   {return version;}
+        int                 getStatus()     const   {return status;}
+        std::string_view    getReason()     const   {return reason;}
+
+        // The headers in the order they were received.
+        std::size_t         size()          const   {return headerCount;}
+        HTTPHeader const*   begin()         const   {return headers.data();}
+        HTTPHeader const*   end()           const   {return headers.data() + headerCount;}
+
+        // Case insensitive lookup.
+        // Returns the value of the first header called `name`.
+        bool hasHeader(std::string_view name) const
+        {
+            return findHeader(name) != end();
+        }
+        std::string_view getHeader(std::string_view name) const
+        {
+            HTTPHeader const* find = findHeader(name);
+            return find == end() ? std::string_view() : find->value;
+        }
+    private:
+        HTTPHeader const* findHeader(std::string_view name) const
+        {
+            for(HTTPHeader const* loop = begin(); loop != end(); ++loop)
+            {
+                if (HTTPScanner::equalIgnoreCase(loop->name, name))
+                {
+                    return loop;
+                }
+            }
+            return end();
+        }
+};
+
+    }
+}
+
+#endif
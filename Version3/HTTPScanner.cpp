@@ -0,0 +1,285 @@
+
+#include "HTTPScanner.h"
+#include "Utility.h"
+#include <stdexcept>
+#include <limits>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define THORSANVIL_SOCKET_SCANNER_SIMD  1
+#include <immintrin.h>
+#endif
+
+using namespace ThorsAnvil::Socket;
+
+HTTPScanner::Implementation HTTPScanner::implementation    = HTTPScanner::bestImplementation();
+HTTPScanner::ScanFunction   HTTPScanner::scanFunction      = HTTPScanner::getScanFunction(HTTPScanner::implementation);
+
+HTTPScanner::HTTPScanner()
+{
+    // Enough for most messages so the vector does not need to grow.
+    lines.reserve(32);
+    reset();
+}
+
+void HTTPScanner::reset()
+{
+    lines.clear();
+    position    = 0;
+    lineStart   = 0;
+    colon       = noColon;
+}
+
+HTTPScanner::Implementation HTTPScanner::bestImplementation()
+{
+#ifdef THORSANVIL_SOCKET_SCANNER_SIMD
+    // We may be called during static initialization.
+    // So make sure the CPU information is available.
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+    {
+        return AVX2;
+    }
+    if (__builtin_cpu_supports("sse4.2"))
+    {
+        return SSE42;
+    }
+#endif
+    return Scalar;
+}
+
+bool HTTPScanner::isSupported(Implementation impl)
+{
+    return impl <= bestImplementation();
+}
+
+void HTTPScanner::setImplementation(Implementation impl)
+{
+    if (!isSupported(impl))
+    {
+        throw std::domain_error(buildErrorMessage("HTTPScanner::", __func__, ": implementation not supported by this CPU: ", getImplementationName(impl)));
+    }
+    implementation  = impl;
+    scanFunction    = getScanFunction(impl);
+}
+
+HTTPScanner::ScanFunction HTTPScanner::getScanFunction(Implementation impl)
+{
+    switch(impl)
+    {
+        case AVX2:  return &HTTPScanner::scanAVX2;
+        case SSE42: return &HTTPScanner::scanSSE42;
+        default:    return &HTTPScanner::scanScalar;
+    }
+}
+
+char const* HTTPScanner::getImplementationName(Implementation impl)
+{
+    switch(impl)
+    {
+        case AVX2:  return "AVX2";
+        case SSE42: return "SSE4.2";
+        default:    return "Scalar";
+    }
+}
+
+/*
+ * Called for each '\n' or ':' found in the head.
+ * Builds the line table. Returns the size of the head when the empty
+ * line that terminates it is found, otherwise 0.
+ */
+std::size_t HTTPScanner::found(char const* data, std::size_t offset)
+{
+    if (data[offset] == ':')
+    {
+        if (colon == noColon)
+        {
+            colon = offset;
+        }
+        return 0;
+    }
+
+    if (offset == lineStart || data[offset - 1] != '\r')
+    {
+        throw HTTPParseError(buildErrorMessage("HTTPScanner::", __func__, ": Header line not terminated by \\r\\n"));
+    }
+    std::uint32_t end = offset - 1;
+    if (end == lineStart)
+    {
+        if (lines.empty())
+        {
+            // RFC 7230 3.5: Ignore empty lines before the start line.
+            lineStart = offset + 1;
+            colon     = noColon;
+            return 0;
+        }
+        // The empty line marks the end of the head.
+        return offset + 1;
+    }
+    lines.push_back({lineStart, colon, end});
+    lineStart   = offset + 1;
+    colon       = noColon;
+    return 0;
+}
+
+std::size_t HTTPScanner::scanScalar(char const* data, std::size_t size)
+{
+    // Use a local for the loop so the compiler does not need to
+    // store `position` back to memory on every character.
+    for(std::size_t offset = position; offset < size; ++offset)
+    {
+        char c = data[offset];
+        if (c == '\n' || c == ':')
+        {
+            std::size_t head = found(data, offset);
+            if (head != 0)
+            {
+                position = head;
+                return head;
+            }
+        }
+    }
+    position = size;
+    return 0;
+}
+
+#ifdef THORSANVIL_SOCKET_SCANNER_SIMD
+
+__attribute__((target("sse4.2")))
+std::size_t HTTPScanner::scanSSE42(char const* data, std::size_t size)
+{
+    __m128i const   special = _mm_setr_epi8('\n', ':', 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0);
+
+    for(; position + 16 <= size; position += 16)
+    {
+        __m128i const   block   = _mm_loadu_si128(reinterpret_cast<__m128i const*>(data + position));
+        __m128i const   match   = _mm_cmpestrm(special, 2, block, 16, _SIDD_UBYTE_OPS | _SIDD_CMP_EQUAL_ANY | _SIDD_BIT_MASK);
+        std::uint32_t   mask    = _mm_cvtsi128_si32(match) & 0xFFFF;
+        while(mask != 0)
+        {
+            std::size_t offset  = position + __builtin_ctz(mask);
+            mask &= mask - 1;
+
+            std::size_t head = found(data, offset);
+            if (head != 0)
+            {
+                position = head;
+                return head;
+            }
+        }
+    }
+    // Less than a full block left.
+    return scanScalar(data, size);
+}
+
+__attribute__((target("avx2")))
+std::size_t HTTPScanner::scanAVX2(char const* data, std::size_t size)
+{
+    __m256i const   newLine = _mm256_set1_epi8('\n');
+    __m256i const   colons  = _mm256_set1_epi8(':');
+
+    for(; position + 32 <= size; position += 32)
+    {
+        __m256i const   block   = _mm256_loadu_si256(reinterpret_cast<__m256i const*>(data + position));
+        __m256i const   match   = _mm256_or_si256(_mm256_cmpeq_epi8(block, newLine), _mm256_cmpeq_epi8(block, colons));
+        std::uint32_t   mask    = _mm256_movemask_epi8(match);
+        while(mask != 0)
+        {
+            std::size_t offset  = position + __builtin_ctz(mask);
+            mask &= mask - 1;
+
+            std::size_t head = found(data, offset);
+            if (head != 0)
+            {
+                position = head;
+                return head;
+            }
+        }
+    }
+    // Less than a full block left.
+    return scanScalar(data, size);
+}
+
+#else
+
+std::size_t HTTPScanner::scanSSE42(char const* data, std::size_t size)
+{
+    return scanScalar(data, size);
+}
+
+std::size_t HTTPScanner::scanAVX2(char const* data, std::size_t size)
+{
+    return scanScalar(data, size);
+}
+
+#endif
+
+bool HTTPScanner::equalIgnoreCase(char const* begin, char const* end, char const* value)
+{
+    // Header names are ASCII so a simple case fold is enough.
+    auto lower = [](char c){return (c >= 'A' && c <= 'Z') ? static_cast<char>(c - 'A' + 'a') : c;};
+
+    for(; begin != end && *value != '\0'; ++begin, ++value)
+    {
+        if (lower(*begin) != lower(*value))
+        {
+            return false;
+        }
+    }
+    return begin == end && *value == '\0';
+}
+
+bool HTTPScanner::equalIgnoreCase(std::string_view lhs, std::string_view rhs)
+{
+    auto lower = [](char c){return (c >= 'A' && c <= 'Z') ? static_cast<char>(c - 'A' + 'a') : c;};
+
+    if (lhs.size() != rhs.size())
+    {
+        return false;
+    }
+    for(std::size_t loop = 0; loop < lhs.size(); ++loop)
+    {
+        if (lower(lhs[loop]) != lower(rhs[loop]))
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+void HTTPScanner::trim(char const*& begin, char const*& end)
+{
+    while(begin != end && (*begin == ' ' || *begin == '\t'))
+    {
+        ++begin;
+    }
+    while(begin != end && (end[-1] == ' ' || end[-1] == '\t'))
+    {
+        --end;
+    }
+}
+
+bool HTTPScanner::parseSize(char const* begin, char const* end, std::size_t& value)
+{
+    static constexpr std::size_t maxValue = std::numeric_limits<std::size_t>::max();
+
+    if (begin == end)
+    {
+        return false;
+    }
+    std::size_t result = 0;
+    for(; begin != end; ++begin)
+    {
+        if (*begin < '0' || *begin > '9')
+        {
+            return false;
+        }
+        std::size_t digit = *begin - '0';
+        if (result > (maxValue - digit) / 10)
+        {
+            return false;
+        }
+        result = result * 10 + digit;
+    }
+    value = result;
+    return true;
+}
@@ -0,0 +1,100 @@
+
+#ifndef THORSANVIL_SOCKET_HTTP_SCANNER_H
+#define THORSANVIL_SOCKET_HTTP_SCANNER_H
+
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+#include <string_view>
+#include <stdexcept>
+
+namespace ThorsAnvil
+{
+    namespace Socket
+    {
+
+// The data read is not a valid HTTP message (the other side's error).
+// Failures of the connection itself are std::runtime_error.
+class HTTPParseError: public std::runtime_error
+{
+    public:
+        using std::runtime_error::runtime_error;
+};
+
+// The position of a line in the message head.
+// All values are offsets from the start of the head.
+//      begin:  First character of the line.
+//      colon:  The first ':' on the line (or HTTPScanner::noColon)
+//      end:    The '\r' of the terminating "\r\n"
+struct HTTPLine
+{
+    std::uint32_t   begin;
+    std::uint32_t   colon;
+    std::uint32_t   end;
+};
+
+// Finds the structure of an HTTP message head (start line and headers)
+// in a single pass over the data.
+//
+// The only interesting characters are '\n' (end of line) and ':' (end of
+// header name). The scan uses SIMD compares to find these 16 (SSE4.2) or
+// 32 (AVX2) bytes at a time. The best implementation the CPU supports is
+// selected at runtime with a scalar version as the fallback.
+class HTTPScanner
+{
+    public:
+        enum Implementation {Scalar, SSE42, AVX2};
+        static constexpr std::uint32_t noColon = static_cast<std::uint32_t>(-1);
+    private:
+        using ScanFunction = std::size_t (HTTPScanner::*)(char const* data, std::size_t size);
+        static ScanFunction     scanFunction;
+        static Implementation   implementation;
+
+        std::vector<HTTPLine>   lines;
+        std::size_t             position;
+        std::uint32_t           lineStart;
+        std::uint32_t           colon;
+
+        std::size_t scanScalar(char const* data, std::size_t size);
+        std::size_t scanSSE42(char const* data, std::size_t size);
+        std::size_t scanAVX2(char const* data, std::size_t size);
+        std::size_t found(char const* data, std::size_t offset);
+
+        static Implementation bestImplementation();
+        static ScanFunction   getScanFunction(Implementation impl);
+    public:
+        HTTPScanner();
+
+        // Start scanning a new message head.
+        void reset();
+
+        // Scan [data, data + size) for the end of the message head.
+        // Can be called repeatedly as more data arrives (`data` must not move
+        // and only the new bytes are scanned).
+        // Returns the size of the head (including the empty line) or 0 if
+        // the head is not yet complete.
+        std::size_t scan(char const* data, std::size_t size)  {return (this->*scanFunction)(data, size);}
+
+        // The start line followed by each header line.
+        std::vector<HTTPLine> const& getLines() const           {return lines;}
+
+        static Implementation getImplementation()               {return implementation;}
+        static bool           isSupported(Implementation impl);
+        // Force a specific implementation (for benchmarking).
+        static void           setImplementation(Implementation impl);
+        static char const*    getImplementationName(Implementation impl);
+
+        // Case insensitive compare of [begin, end) against `value`.
+        static bool         equalIgnoreCase(char const* begin, char const* end, char const* value);
+        static bool         equalIgnoreCase(std::string_view lhs, std::string_view rhs);
+        // Remove leading and trailing white space from [begin, end).
+        static void         trim(char const*& begin, char const*& end);
+        // Parse a non negative decimal number.
+        // Returns false if [begin, end) is not a valid number.
+        static bool         parseSize(char const* begin, char const* end, std::size_t& value);
+};
+
+    }
+}
+
+#endif
@@ -1,17 +1,25 @@
 
 #include "ProtocolHTTP.h"
+#include "HTTPScanner.h"
+#include "HTTPDate.h"
 #include "Socket.h"
 #include "Utility.h"
-#include <iomanip>
+#include "Metrics.h"
+#include "Trace.h"
 #include <exception>
+#include <algorithm>
+#include <cstring>
+#include <strings.h>
+#include <charconv>
 
 /*
  * If it is not reading the body it buffers the data internally.
  *
  * Status/Header Lines:
  * ====================
- * When reading the status or headers it will return a single line at a time from
- *      getMessageData()
+ * The status line and headers are read into the internal buffer until the
+ * whole head is available. HTTPScanner then finds the structure of all the
+ * lines in a single pass.
  *
  * It will prefer to use the internal buffer only reading from the socket when
  * required.
@@ -22,57 +30,133 @@
  * is in the internal buffer it will be first copied to the user provided buffer
  * before a call to the socket is made for more data.
  *
+ * A chunked body is decoded as it is read. The chunk size lines are read
+ * into the internal buffer (after the head) and only the chunk data is
+ * passed to the user provided buffer.
+ *
  * Note:
  * ====================
  * This class assumes the socket connection will be reused as a result it will
  * maintain the input buffer between requests in case part of the next message
- * has been read.
- * BUT: Currently the sendMessage() for both client and server
- *      will close the socket with the call to socket.putMessageClose()
+ * has been read. This allows pipelined requests to be served from the buffer.
+ *
+ * The input buffer is a mirrored ring buffer (see BufferPool). So the next
+ * message is parsed where it is (even if it wraps around the end of the
+ * buffer) rather than being moved to the front of the buffer first.
+ *
+ * The connection is only closed (socket.putMessageClose()) when one side
+ * has asked for "Connection: close".
  * 
  */
 
 using namespace ThorsAnvil::Socket;
 
-
-ProtocolHTTP::ProtocolHTTP(DataSocket& socket)
+ProtocolHTTP::ProtocolHTTP(DataSocket& socket, BufferPool& pool)
     : Protocol(socket)
-    , bufferData(bufferSize)
+    , bufferData(pool.acquire())
+    , bufferSize(bufferData.size())
     , bufferRange(bufferData)
-{}
+    , messageStart(bufferData.data())
+    , headSize(0)
+    , connectionKeepAlive(true)
+    , chunkedBody(false)
+    , chunkFirst(false)
+    , chunkDone(false)
+    , chunkRemaining(0)
+{
+    // The connection is kept open between messages.
+    // So don't let Nagle hold back the last part of a message.
+    socket.setNoDelay();
+}
 
 /*
  * The functions to send a message using the HTTP Protocol
  *      sendMessage
  *          putMessageData
+ *          putMessageEnd
  *              socket
  */
+HTTPClient::HTTPClient(DataSocket& socket, BufferPool& pool)
+    : ProtocolHTTP(socket, pool)
+    , responsesPending(0)
+{}
+
+HTTPClient::HTTPClient(ConnectionPool::Connection&& borrowed, BufferPool& pool)
+    : HTTPClientConnection{std::move(borrowed)}
+    , ProtocolHTTP(connection.getSocket(), pool)
+    , responsesPending(0)
+{}
+
+HTTPClient::~HTTPClient()
+{
+    // A response still to arrive (or left in the buffer) would be
+    // read by the next user of the connection.
+    connection.setReusable(responsesPending == 0 && keepAlive() && !hasUnreadInput());
+}
+
+void HTTPClient::recvMessage(std::string& message)
+{
+    ProtocolHTTP::recvMessage(message);
+    --responsesPending;
+}
+
+void HTTPClient::recvMessage(MessageSink const& sink)
+{
+    ProtocolHTTP::recvMessage(sink);
+    --responsesPending;
+}
+
 void HTTPClient::sendMessage(std::string const& url, std::string const& message)
+{
+    putMessageHeaders(url, message.size());
+
+    // The Message Body
+    putMessageData(message);
+    putMessageEnd();
+}
+
+void HTTPClient::sendMessageStart(std::string const& url)
+{
+    putMessageHeaders(url, chunkedSize);
+}
+
+void HTTPClient::putMessageHeaders(std::string const& url, std::size_t bodySize)
 {
     // The Message Method
+    char const* method;
     switch(getRequestType())
     {
-        case Head:   putMessageData(buildStringFromParts("HEAD ",   url.c_str(), " HTTP/1.1\r\n"));   break;
-        case Get:    putMessageData(buildStringFromParts("GET ",    url.c_str(), " HTTP/1.1\r\n"));   break;
-        case Put:    putMessageData(buildStringFromParts("PUT ",    url.c_str(), " HTTP/1.1\r\n"));   break;
-        case Post:   putMessageData(buildStringFromParts("POST ",   url.c_str(), " HTTP/1.1\r\n"));   break;
-        case Delete: putMessageData(buildStringFromParts("DELETE ", url.c_str(), " HTTP/1.1\r\n"));   break;
+        case Head:   method = "HEAD ";      break;
+        case Get:    method = "GET ";       break;
+        case Put:    method = "PUT ";       break;
+        case Post:   method = "POST ";      break;
+        case Delete: method = "DELETE ";    break;
         default:
             throw std::logic_error(buildStringFromParts("ProtocolHTTP::", __func__, ": unsupported message type requested"));
     }
 
-
-    // The Message Headers
-    putMessageData("Content-Type: text/text\r\n");
-    putMessageData(buildStringFromParts("Content-Length: ", message.size(), "\r\n"));
-    putMessageData(buildStringFromParts("Host: ", getHost(), "\r\n"));
-    putMessageData("User-Agent: ThorsExperimental-Client/0.1\r\n");
-    putMessageData("Accept: */*\r\n");
-    putMessageData("\r\n");
-
-    // The Message Body
-    putMessageData(message);
-    socket.putMessageClose();
+    // The request line and headers are built into a single reused string.
+    requestHead.clear();
+    appendStringParts(requestHead, method, url, " HTTP/1.1\r\n"
+                                   "Content-Type: text/text\r\n"
+                                   "Host: ", getHost(), "\r\n"
+                                   "User-Agent: ThorsExperimental-Client/0.1\r\n"
+                                   "Accept: */*\r\n");
+    if (bodySize == chunkedSize)
+    {
+        appendStringParts(requestHead, "Transfer-Encoding: chunked\r\n");
+    }
+    else
+    {
+        appendStringParts(requestHead, "Content-Length: ", bodySize, "\r\n");
+    }
+    if (!keepAlive())
+    {
+        appendStringParts(requestHead, "Connection: close\r\n");
+    }
+    appendStringParts(requestHead, "\r\n");
+    putMessageData(requestHead);
+    ++responsesPending;
 }
 
 /*
@@ -82,170 +166,599 @@ void HTTPClient::sendMessage(std::string const& url, std::string const& message)
  */
 int HTTPClient::getMessageStartLine()
 {
-    getMessageData(nullptr, 0);
-
-    char    space1       = '\0';
-    char    space2       = '\0';
-    char    backslashR   = '\0';
-    char    backslashN   = '\0';
-    int     responseCode = 0;
-    char    responseDescription[1024];
-    int     count = std::sscanf(begin(), "HTTP/1.1%c%d%c%1023[^\r\n]%c%c",
-                                &space1,
-                                &responseCode,
-                                &space2,
-                                responseDescription,
-                                &backslashR,
-                                &backslashN);
-    if (count != 6 || space1 != ' ' || space2 != ' ' || backslashR != '\r' || backslashN != '\n' || responseCode < 100 || responseCode >= 600)
-    {
-        throw std::runtime_error(buildErrorMessage("ProtocolHTTP::", __func__, ": Invalid HTTP Status Line:",
-                                 " count(6)=", count,
-                                 " space1(32)=", static_cast<int>(space1),
-                                 " space2(32)=", static_cast<int>(space2),
-                                 " backslashR(10)=", static_cast<int>(backslashR),
-                                 " backslashN(13)=", static_cast<int>(backslashN),
-                                 " responseCode=", responseCode,
-                                 "Line: >", std::string(begin(), end()), "<"));
+    // Status Line: HTTP/1.1 <3 Digit Code> <Reason>\r\n
+    static constexpr char const version[]  = "HTTP/1.1 ";
+    static constexpr std::size_t versionSize = sizeof(version) - 1;
+
+    char const* line    = startLineBegin();
+    char const* lineEnd = startLineEnd();
+    int         responseCode = 0;
+    bool        valid   = lineEnd - line >= static_cast<std::ptrdiff_t>(versionSize + 4)
+                        && std::equal(version, version + versionSize, line)
+                        && line[versionSize + 3] == ' ';
+    if (valid)
+    {
+        for(char const* digit = line + versionSize; digit != line + versionSize + 3; ++digit)
+        {
+            valid           = valid && *digit >= '0' && *digit <= '9';
+            responseCode    = responseCode * 10 + (*digit - '0');
+        }
+    }
+    if (!valid || responseCode < 100 || responseCode >= 600)
+    {
+        throw HTTPParseError(buildErrorMessage("ProtocolHTTP::", __func__, ": Invalid HTTP Status Line:",
+                                 " Line: >", std::string(line, lineEnd), "<"));
     }
+    char const* reason  = line + versionSize + 4;
+    getMessageViewForUpdate().setResponse(std::string_view(line, versionSize - 1),
+                                          responseCode,
+                                          std::string_view(reason, lineEnd - reason));
     return responseCode;
 }
 
+HTTPServer::HTTPServer(DataSocket& socket, BufferPool& pool)
+    : ProtocolHTTP(socket, pool)
+    , created(socket.getOpenTime())
+    , firstRequest(true)
+    , headPending(false)
+    , pendingBodySize(0)
+{
+    Metrics::count(Metrics::Opened);
+}
+
+HTTPServer::~HTTPServer()
+{
+    Metrics::count(Metrics::Closed);
+}
+
+/*
+ * The head of the next request is read here (rather than by recvMessage())
+ * so requests for the metrics can be served without the caller seeing them.
+ */
+bool HTTPServer::hasMessage()
+{
+    if (headPending)
+    {
+        return true;
+    }
+    if (!ProtocolHTTP::hasMessage())
+    {
+        return false;
+    }
+    startRequest();
+    headPending = nextRequest();
+    return headPending;
+}
+
+void HTTPServer::recvMessage(std::string& message)
+{
+    getMessageBody(takeRequestHead(), message);
+    endRequest();
+}
+
+void HTTPServer::recvMessage(MessageSink const& sink)
+{
+    getMessageBody(takeRequestHead(), sink);
+    endRequest();
+}
+
+// The body size of the request whose head has been read.
+// If hasMessage() was not called first the head is read now.
+std::size_t HTTPServer::takeRequestHead()
+{
+    if (!headPending)
+    {
+        startRequest();
+        if (!nextRequest())
+        {
+            throw std::runtime_error(buildErrorMessage("HTTPServer::", __func__, ": Connection closed before message"));
+        }
+    }
+    headPending = false;
+    return pendingBodySize;
+}
+
+void HTTPServer::endRequest()
+{
+    Metrics::count(Metrics::Requests);
+    Metrics::time(Metrics::Parse, Clock::now() - requestStart);
+}
+
+// Data for a new request is available (or about to be read).
+void HTTPServer::startRequest()
+{
+    requestStart = Clock::now();
+    if (firstRequest)
+    {
+        firstRequest = false;
+        Metrics::time(Metrics::FirstByte, requestStart - created);
+    }
+}
+
+/*
+ * Read the head of the next request that is not for a reserved URL.
+ * Returns false if the connection ends after serving a reserved URL.
+ */
+bool HTTPServer::nextRequest()
+{
+    while(true)
+    {
+        try
+        {
+            pendingBodySize = recvMessageHead();
+        }
+        catch(HTTPParseError const&)
+        {
+            // The rest of the input can't be trusted (we don't know where the
+            // next request starts). So tell the client and close the connection.
+            Metrics::count(Metrics::ParseErrors);
+            setKeepAlive(false);
+            sendError(400);
+            throw;
+        }
+
+        HTTPMessageView const& view = getMessageView();
+        bool    metrics = view.getUrl() == metricsUrl;
+        if ((!metrics && view.getUrl() != traceUrl) || view.getMethod() != "GET")
+        {
+            return true;
+        }
+
+        std::string body;
+        getMessageBody(pendingBodySize, body);
+        if (metrics)
+        {
+            sendReserved(Metrics::prometheus(), "Content-Type: text/plain; version=0.0.4\r\n");
+        }
+        else
+        {
+            std::ostringstream  trace;
+            Trace::dump(trace);
+            sendReserved(trace.str(), "Content-Type: application/json\r\n");
+        }
+
+        if (!ProtocolHTTP::hasMessage())
+        {
+            return false;
+        }
+        startRequest();
+    }
+}
+
+void HTTPServer::sendReserved(std::string&& body, char const* contentType)
+{
+    putMessageHeaders(body.size(), contentType);
+    putMessageData(std::move(body));
+    putMessageEnd();
+}
+
 /*
  * The functions to send a message using the HTTP Protocol
  *      sendMessage
  *          putMessageData
+ *          putMessageEnd
  *              socket
  */
 void HTTPServer::sendMessage(std::string const&, std::string const& message)
 {
-    putMessageData("HTTP/1.1 200 OK\r\n");
+    sendStart = Clock::now();
+    putMessageHeaders(message.size());
+
+    // The Message Body
+    putMessageData(message);
+    putMessageEnd();
+    Metrics::time(Metrics::Send, Clock::now() - sendStart);
+}
 
-    std::time_t t = std::time(nullptr);
-    std::tm tm = *std::localtime(&t);
+void HTTPServer::sendError(int status, std::string&& headers)
+{
+    char const* statusLine;
+    switch(status)
+    {
+        case 400:   statusLine = "HTTP/1.1 400 Bad Request\r\n";              break;
+        case 404:   statusLine = "HTTP/1.1 404 Not Found\r\n";                break;
+        case 405:   statusLine = "HTTP/1.1 405 Method Not Allowed\r\n";       break;
+        case 500:   statusLine = "HTTP/1.1 500 Internal Server Error\r\n";    break;
+        case 501:   statusLine = "HTTP/1.1 501 Not Implemented\r\n";          break;
+        case 503:   statusLine = "HTTP/1.1 503 Service Unavailable\r\n";      break;
+        default:
+            throw std::domain_error(buildErrorMessage("HTTPServer::", __func__, ": Unsupported status: ", status));
+    }
+    sendStart = Clock::now();
+    // The extra headers are sent with the Content-Type line.
+    // Note: `headers` is not copied but stays valid until the message is sent.
+    headers.insert(0, "Content-Type: text/text\r\n");
+    putMessageHeaders(0, headers.c_str(), statusLine);
+    putMessageEnd();
+    Metrics::time(Metrics::Send, Clock::now() - sendStart);
+}
 
-    // The Message Headers
-    putMessageData(buildStringFromParts("Date: ", std::put_time(&tm, "%c %Z"), "\r\n"));
-    putMessageData("Server: ThorsExperimental-Server/0.1\r\n");
-    putMessageData(buildStringFromParts("Content-Length: ", message.size(), "\r\n"));
-    putMessageData("Content-Type: text/text\r\n");
-    putMessageData("\r\n");
+/*
+ * The status line, fixed headers and body are already in `entry`.
+ * Only the Date (and "Connection: close") are added between them.
+ */
+void HTTPServer::sendCached(ResponseCache::Entry const& entry)
+{
+    sendStart = Clock::now();
+    std::string_view    date(HTTPDate::now(), HTTPDate::size);
+    char*               out = buildStringInto(std::begin(responseHead), std::end(responseHead), "Date: ", date, "\r\n");
+
+    putMessageData(entry.head().data(), entry.head().size());
+    putMessageData(responseHead, out - responseHead);
+    if (!keepAlive())
+    {
+        putMessageData("Connection: close\r\n");
+    }
+    putMessageData(entry.tail().data(), entry.tail().size());
+    putMessageEnd();
+    Metrics::time(Metrics::Send, Clock::now() - sendStart);
+}
+
+void HTTPServer::appendFixedHead(std::string& output, std::size_t bodySize, char const* contentType)
+{
+    appendStringParts(output, "HTTP/1.1 200 OK\r\n", serverHead, contentType, "Content-Length: ", bodySize, "\r\n");
+}
+
+/*
+ * The body is copied from the file to the socket by the kernel (sendfile).
+ * So the file content never passes through user space.
+ * The head is sent with MSG_MORE so it goes out in the same packet
+ * as the start of the file (TCP_NODELAY would send it on its own).
+ */
+void HTTPServer::sendFile(std::string const&, int fileId, off_t offset, std::size_t size)
+{
+    sendStart = Clock::now();
+    putMessageHeaders(size);
+    putMessageFlush(size != 0);
 
     // The Message Body
-    putMessageData(message);
-    socket.putMessageClose();
+    socket.putMessageFile(fileId, offset, size);
+    putMessageEnd();
+    Metrics::time(Metrics::Send, Clock::now() - sendStart);
+}
+
+/*
+ * The headers are held back and sent with the first chunk.
+ */
+void HTTPServer::sendMessageStart(std::string const&)
+{
+    sendStart = Clock::now();
+    putMessageHeaders(chunkedSize);
+}
+
+void HTTPServer::sendMessageEnd()
+{
+    putMessageChunkEnd();
+    Metrics::time(Metrics::Send, Clock::now() - sendStart);
+}
+
+/*
+ * The response head is:
+ *      The status line (a literal) and a constant block (built at compile time).
+ *      The Content-Type line (a literal).
+ *      The Date and Content-Length (patched into `responseHead`).
+ *          The Date is cached and only formatted once a second.
+ *          The length is written with to_chars() (see buildStringInto()).
+ *      The optional "Connection: close".
+ * These are sent by the writev() with the body so are not copied.
+ */
+void HTTPServer::putMessageHeaders(std::size_t bodySize, char const* contentType, char const* statusLine)
+{
+    putMessageData(statusLine);
+    putMessageData(serverHead, sizeof(serverHead) - 1);
+    putMessageData(contentType);
+
+    std::string_view    date(HTTPDate::now(), HTTPDate::size);
+    char*               out;
+    if (bodySize == chunkedSize)
+    {
+        out = buildStringInto(std::begin(responseHead), std::end(responseHead), "Date: ", date, "\r\nTransfer-Encoding: chunked\r\n");
+    }
+    else
+    {
+        out = buildStringInto(std::begin(responseHead), std::end(responseHead), "Date: ", date, "\r\nContent-Length: ", bodySize, "\r\n");
+    }
+    putMessageData(responseHead, out - responseHead);
+
+    if (!keepAlive())
+    {
+        putMessageData("Connection: close\r\n");
+    }
+    putMessageData("\r\n");
 }
 
 int HTTPServer::getMessageStartLine()
 {
-    getMessageData(nullptr, 0);
-
-    char    command[32];
-    char    url[4096];
-    char    version[32];
-    char    space1;
-    char    space2;
-    char    backslashR;
-    char    backslashN;
-    int     count = std::sscanf(begin(), "%s%c%s%c%s%c%c",
-                                command,
-                                &space1,
-                                url,
-                                &space2,
-                                version,
-                                &backslashR,
-                                &backslashN);
-    if (count != 7 || space1 != ' ' || space2 != ' ' || backslashR != '\r' || backslashN != '\n' || strcmp(version, "HTTP/1.1") != 0)
-    {
-        throw std::runtime_error(buildErrorMessage("ProtocolHTTP::", __func__, ": Invalid HTTP Request Line:",
-                                 " count(7)=", count,
-                                 " space1(32)=", static_cast<int>(space1),
-                                 " space2(32)=", static_cast<int>(space2),
-                                 " backslashR(10)=", static_cast<int>(backslashR),
-                                 " backslashN(13)=", static_cast<int>(backslashN),
-                                 " version(HTTP/1.1)=", version,
-                                 " Line: >", std::string(begin(), end()), "<"));
+    // Request Line: <Method> <URL> HTTP/1.1\r\n
+    char const* line    = startLineBegin();
+    char const* lineEnd = startLineEnd();
+    char const* space1  = std::find(line, lineEnd, ' ');
+    char const* space2  = std::find(space1 == lineEnd ? lineEnd : space1 + 1, lineEnd, ' ');
+    if (space1 == line || space2 == lineEnd || space2 == space1 + 1 || !HTTPScanner::equalIgnoreCase(space2 + 1, lineEnd, "HTTP/1.1"))
+    {
+        throw HTTPParseError(buildErrorMessage("ProtocolHTTP::", __func__, ": Invalid HTTP Request Line:",
+                                 " Line: >", std::string(line, lineEnd), "<"));
     }
+    getMessageViewForUpdate().setRequest(std::string_view(line, space1 - line),
+                                         std::string_view(space1 + 1, space2 - space1 - 1),
+                                         std::string_view(space2 + 1, lineEnd - space2 - 1));
     return 200;
 }
 
+void ProtocolHTTP::putMessageData(char const* literal)
+{
+    messageParts.push_back({const_cast<char*>(literal), std::strlen(literal)});
+}
+
+void ProtocolHTTP::putMessageData(char const* data, std::size_t size)
+{
+    messageParts.push_back({const_cast<char*>(data), size});
+}
+
 void ProtocolHTTP::putMessageData(std::string const& item)
 {
-    socket.putMessageData(item.c_str(), item.size());
+    messageParts.push_back({const_cast<char*>(item.data()), item.size()});
+}
+
+void ProtocolHTTP::putMessageData(std::string&& item)
+{
+    // A deque does not move its elements when it grows.
+    // So the pointer to the string data remains valid.
+    messageStore.emplace_back(std::move(item));
+    putMessageData(messageStore.back());
+}
+
+void ProtocolHTTP::putMessageFlush(bool more)
+{
+    if (messageParts.empty())
+    {
+        return;
+    }
+    // Send the status line, headers and body with a single system call.
+    socket.putMessageData(messageParts.data(), messageParts.size(), more);
+    messageParts.clear();
+    messageStore.clear();
+}
+
+void ProtocolHTTP::putMessageEnd()
+{
+    putMessageFlush();
+
+    // Persistent connections stay open for the next message.
+    if (!keepAlive())
+    {
+        socket.putMessageClose();
+    }
+}
+
+/*
+ * Chunked body:
+ *      <size in hex>\r\n
+ *      <data>\r\n
+ *      ...
+ *      0\r\n
+ *      \r\n
+ * Each chunk (size line, data and terminator) is sent with a single writev()
+ * so the other end sees data as soon as it is generated.
+ */
+void ProtocolHTTP::putMessageChunk(std::string const& chunk)
+{
+    if (chunk.empty())
+    {
+        return;
+    }
+    char*       sizeEnd = std::to_chars(chunkSizeLine, chunkSizeLine + sizeof(chunkSizeLine), chunk.size(), 16).ptr;
+    *sizeEnd++  = '\r';
+    *sizeEnd++  = '\n';
+
+    putMessageData(chunkSizeLine, sizeEnd - chunkSizeLine);
+    putMessageData(chunk);
+    putMessageData("\r\n");
+    putMessageFlush();
+}
+
+void ProtocolHTTP::putMessageChunkEnd()
+{
+    putMessageData("0\r\n\r\n");
+    putMessageEnd();
+}
+
+/*
+ * Check for the start of another message on a persistent connection.
+ * Any bytes already buffered (pipelined requests) count as a message.
+ * Otherwise wait for the next read from the socket.
+ */
+bool ProtocolHTTP::hasMessage()
+{
+    if (!keepAlive())
+    {
+        return false;
+    }
+
+    // Discard the last message head we processed.
+    bufferRange.inputStart  += bufferRange.inputLength;
+    bufferRange.totalLength -= bufferRange.inputLength;
+    bufferRange.inputLength = 0;
+
+    if (bufferRange.totalLength != 0)
+    {
+        return true;
+    }
+
+    bufferRange.inputStart  = &bufferData[0];
+    std::size_t got = socket.getMessageData(bufferRange.inputStart, bufferSize, [](std::size_t){return true;});
+    bufferRange.totalLength = got;
+    if (got == 0)
+    {
+        connectionKeepAlive = false;
+    }
+    return got != 0;
 }
 
 /*
  * The functions to get a message using the HTTP Protocol
  *      recvMessage
+ *          getMessageHead
+ *              scanner
+ *              socket
  *          getMessageStartLine
  *          getMessageHeader
- *          getMessageBody
+ *          getMessageBody                  (std::string or MessageSink)
  *
  *      getMessageData
- *          getMessageDataFromBuffer
- *          getMessageDataFromStream
- *              socket
+ *          getMessageChunkData             (Transfer-Encoding: chunked)
+ *              getMessageChunkSize
+ *                  getMessageLine
+ *          getMessageDataRaw
+ *              getMessageDataFromBuffer
+ *              getMessageDataFromStream
+ *                  socket
  */
 void ProtocolHTTP::recvMessage(std::string& message)
 {
+    getMessageBody(recvMessageHead(), message);
+}
+
+void ProtocolHTTP::recvMessage(MessageSink const& sink)
+{
+    getMessageBody(recvMessageHead(), sink);
+}
+
+std::size_t ProtocolHTTP::recvMessageHead()
+{
+    Trace::Scope    trace(Trace::Parse, socket.getSocketId());
+    if (getMessageHead() == 0)
+    {
+        throw std::runtime_error(buildErrorMessage("ProtocolHTTP::", __func__, ": Connection closed before message"));
+    }
     int         responseCode = getMessageStartLine();
-    std::size_t bodySize     = getMessageHeader(responseCode);
-    getMessageBody(bodySize, message);
+    return getMessageHeader(responseCode);
 }
 
 /*
- * Read the headers for the stream.
- * Read each header in a loop (looking for the '\r\n' sequence.
+ * Read the status line and headers.
+ * Data is read into the buffer until the scanner finds the empty line
+ * that terminates the headers. So the whole head is in the buffer
+ * (starting at inputStart) and inputLength is its size.
+ *
+ * Returns 0 if the connection was closed before any data was read.
+ */
+std::size_t ProtocolHTTP::getMessageHead()
+{
+    // Discard the previous message head.
+    bufferRange.inputStart  += bufferRange.inputLength;
+    bufferRange.totalLength -= bufferRange.inputLength;
+    bufferRange.inputLength = 0;
+
+    // Part of the next message (pipelined requests) may already be in
+    // the buffer. The buffer is a mirrored ring so rather than moving it
+    // to the front we just wrap the start back into the first copy.
+    // The full buffer size is then available contiguously after it.
+    if (bufferRange.inputStart >= &bufferData[0] + bufferSize)
+    {
+        bufferRange.inputStart -= bufferSize;
+    }
+    messageStart    = bufferRange.inputStart;
+
+    scanner.reset();
+    messageView.clear();
+    headSize        = 0;
+    chunkedBody     = false;
+    while(true)
+    {
+        headSize = scanner.scan(bufferRange.inputStart, bufferRange.totalLength);
+        if (headSize != 0)
+        {
+            bufferRange.inputLength = headSize;
+            return headSize;
+        }
+        if (bufferRange.totalLength == bufferSize)
+        {
+            throw HTTPParseError(buildErrorMessage("ProtocolHTTP::", __func__, ": Header block larger than buffer: ", bufferSize));
+        }
+        std::size_t got = socket.getMessageData(bufferRange.inputStart + bufferRange.totalLength, bufferSize - bufferRange.totalLength, [](std::size_t){return true;});
+        if (got == 0)
+        {
+            if (bufferRange.totalLength == 0)
+            {
+                return 0;
+            }
+            throw std::runtime_error(buildErrorMessage("ProtocolHTTP::", __func__, ": Connection closed inside header block"));
+        }
+        bufferRange.totalLength += got;
+    }
+}
+
+/*
+ * Process the headers found by the scanner.
+ * Each header is also added to the message view.
  *
  * Do some validation on the input and calculate the size
  * of the message body based on the headers.
  */
 std::size_t ProtocolHTTP::getMessageHeader(int responseCode)
 {
-    char        backslashR       = '\0';
-    char        backslashN       = '\0';
     bool        hasIdentity      = false;
+    bool        hasChunked       = false;
     bool        hasContentLength = false;
     bool        hasMultiPart     = false;
+    bool        hasClose         = false;
     std::size_t contentLength = 0;
 
-    char const* begOfRange = nullptr;
-    char const* endOfRange = nullptr;
-    while(getMessageData(nullptr, 0))
+    char const*                     head    = bufferRange.inputStart;
+    std::vector<HTTPLine> const&    lines   = scanner.getLines();
+    for(std::size_t loop = 1; loop < lines.size(); ++loop)
     {
-        begOfRange = bufferRange.inputStart;
-        endOfRange = bufferRange.inputStart + bufferRange.inputLength;
-        if (bufferRange.inputLength <= 2)
+        HTTPLine const& line = lines[loop];
+        if (line.colon == HTTPScanner::noColon || line.colon == line.begin)
         {
-            break;
+            throw HTTPParseError(buildStringFromParts("ProtocolHTTP::", __func__, ": Header line missing colon(:)"));
         }
-        if (!std::equal(endOfRange - 2, endOfRange, endOfLineSeq))
-        {
-            throw std::runtime_error(buildStringFromParts("ProtocolHTTP::", __func__, ": Header line not terminated by empty line"));
-        }
-        if (std::find(begOfRange, endOfRange, ':') == endOfRange)
+        char const* nameBegin   = head + line.begin;
+        char const* nameEnd     = head + line.colon;
+        char const* valueBegin  = nameEnd + 1;
+        char const* valueEnd    = head + line.end;
+        HTTPScanner::trim(valueBegin, valueEnd);
+        messageView.addHeader(std::string_view(nameBegin, nameEnd - nameBegin),
+                              std::string_view(valueBegin, valueEnd - valueBegin));
+
+        if (HTTPScanner::equalIgnoreCase(nameBegin, nameEnd, "Content-Length"))
         {
-            throw std::runtime_error(buildStringFromParts("ProtocolHTTP::", __func__, ": Header line missing colon(:)"));
+            if (!HTTPScanner::parseSize(valueBegin, valueEnd, contentLength))
+            {
+                throw HTTPParseError(buildStringFromParts("ProtocolHTTP::", __func__, ": Invalid Content-Length: ", std::string(valueBegin, valueEnd)));
+            }
+            hasContentLength    = true;
         }
-        if (std::sscanf(begOfRange, "Transfer-Encoding : identity%c%c", &backslashR, &backslashN) == 2
-            && backslashR == '\r' && backslashN == '\n')
+        else if (HTTPScanner::equalIgnoreCase(nameBegin, nameEnd, "Transfer-Encoding"))
         {
-            hasIdentity         = true;
+            // Only the last coding applied determines how the body is framed.
+            char const* coding  = valueEnd;
+            while(coding != valueBegin && coding[-1] != ',')
+            {
+                --coding;
+            }
+            char const* codingEnd = valueEnd;
+            HTTPScanner::trim(coding, codingEnd);
+            hasIdentity         = HTTPScanner::equalIgnoreCase(coding, codingEnd, "identity");
+            hasChunked          = HTTPScanner::equalIgnoreCase(coding, codingEnd, "chunked");
         }
-        if (std::sscanf(begOfRange, "Content-Length : %lu%c%c", &contentLength, &backslashR, &backslashN) == 3
-            && backslashR == '\r' && backslashN == '\n')
+        else if (HTTPScanner::equalIgnoreCase(nameBegin, nameEnd, "Content-Type"))
         {
-            hasContentLength    = true;
+            static constexpr char const multiPart[] = "multipart/byteranges";
+            static constexpr std::size_t multiPartSize = sizeof(multiPart) - 1;
+            hasMultiPart        = valueEnd - valueBegin >= static_cast<std::ptrdiff_t>(multiPartSize)
+                                && HTTPScanner::equalIgnoreCase(valueBegin, valueBegin + multiPartSize, multiPart);
         }
-        if (std::sscanf(begOfRange, "Content-Type : multipart/byteranges%c%c", &backslashR, &backslashN) == 3
-            && backslashR == '\r' && backslashN == '\n')
+        else if (HTTPScanner::equalIgnoreCase(nameBegin, nameEnd, "Connection"))
         {
-            hasMultiPart        = true;
+            hasClose            = HTTPScanner::equalIgnoreCase(valueBegin, valueEnd, "close");
         }
     }
-    if (bufferRange.inputLength != 2 && !std::equal(begOfRange, endOfRange, endOfLineSeq))
+
+    if (hasClose)
     {
-        throw std::runtime_error(buildStringFromParts("ProtocolHTTP::", __func__, ": Header list not terminated by empty line"));
+        connectionKeepAlive = false;
     }
 
     // Use the header fields to work out the size of the body/
@@ -254,6 +767,15 @@ std::size_t ProtocolHTTP::getMessageHeader(int responseCode)
     {
         bodySize = 0;
     }
+    else if (hasChunked)
+    {
+        // RFC 7230 3.3.3: Chunked takes precedence over Content-Length.
+        bodySize        = chunkedSize;
+        chunkedBody     = true;
+        chunkFirst      = true;
+        chunkDone       = false;
+        chunkRemaining  = 0;
+    }
     else if (hasIdentity)
     {
         throw std::domain_error(buildStringFromParts("ProtocolHTTP::", __func__, ": Identity encoding not supported"));
@@ -266,15 +788,25 @@ std::size_t ProtocolHTTP::getMessageHeader(int responseCode)
     {
         throw std::domain_error(buildStringFromParts("ProtocolHTTP::", __func__, ": Mult-Part encoding not supported"));
     }
+    else if (getRequestType() == Response)
+    {
+        // We are the server reading a request.
+        // A request without a length has no body.
+        bodySize = 0;
+    }
     else
     {
+        // The body is terminated by the server closing the connection.
+        // So this connection can not be reused.
         bodySize = -1;
+        connectionKeepAlive = false;
     }
     return bodySize;
 }
 
 /*
- * If we have a `bodySize` of -1 then we read until the stream is closed.
+ * If we have a `bodySize` of -1 then we read until the stream is closed
+ * (or the last chunk of a chunked body).
  * Otherwise we read `bodySize` bytes from the stream.
  * 
  * Note: A closed connection by the client will stop the read and not generate
@@ -284,7 +816,7 @@ std::size_t ProtocolHTTP::getMessageHeader(int responseCode)
 void ProtocolHTTP::getMessageBody(std::size_t bodySize, std::string& message)
 {
     // The Message Body
-    std::size_t maxBodySize = bodySize == static_cast<std::size_t>(-1) ? message.capacity() : bodySize;
+    std::size_t maxBodySize = bodySize == static_cast<std::size_t>(-1) ? std::max(message.capacity(), bufferSize) : bodySize;
     std::size_t messageRead = 0;
     std::size_t readSize;
 
@@ -307,108 +839,238 @@ void ProtocolHTTP::getMessageBody(std::size_t bodySize, std::string& message)
 }
 
 /*
- * Read Data:
+ * Same as above but the body is passed to `sink` one buffer at a time.
+ * So the body is never held in memory.
+ */
+void ProtocolHTTP::getMessageBody(std::size_t bodySize, MessageSink const& sink)
+{
+    char        buffer[sinkBufferSize];
+    std::size_t remaining = bodySize;
+    std::size_t readSize;
+
+    while(remaining != 0 && (readSize = getMessageData(buffer, std::min(remaining, sinkBufferSize))) != 0)
+    {
+        sink(buffer, readSize);
+        if (bodySize != static_cast<std::size_t>(-1))
+        {
+            remaining -= readSize;
+        }
+    }
+}
+
+/*
+ * Read Data (for the body):
  *  Check to see if there is data in the local buffer and use that.
  *  Otherwise read from the socket.
  *
  * Note:
  * ========
- * If we are reading Status/Header information then `localBuffer`
- * will be set to nullptr and we should read the data into the buffer
- * for manual processing.
- *
- * If we are reading the Body the `localBuffer` points at the buffer
- * passed by the user so we can fill it with the content that is
- * coming from the stream.
+ * The `localBuffer` points at the buffer passed by the user so we can
+ * fill it with the content that is coming from the stream.
  */
 std::size_t ProtocolHTTP::getMessageData(char* localBuffer, std::size_t size)
+{
+    if (chunkedBody)
+    {
+        return getMessageChunkData(localBuffer, size);
+    }
+    return getMessageDataRaw(localBuffer, size);
+}
+
+std::size_t ProtocolHTTP::getMessageDataRaw(char* localBuffer, std::size_t size)
 {
 
     if (bufferRange.totalLength != 0)
     {
         std::size_t result = getMessageDataFromBuffer(localBuffer, size);
-        if (result != 0)
+        if (result != 0 || bufferRange.totalLength != 0)
         {
+            // Either we got data or the caller's buffer is full
+            // (and what remains belongs to the next message).
             return result;
         }
     }
-    else
-    {
-        bufferRange.inputStart  = &bufferData[0];
-    }
+    // The buffer is empty.
+    // Reset to just after the head (which the message view uses).
+    bufferRange.inputStart  = messageStart + headSize;
 
     return getMessageDataFromStream(localBuffer, size);
 }
 
 std::size_t ProtocolHTTP::getMessageDataFromBuffer(char* localBuffer, std::size_t size)
 {
+    // Discard the message head.
     bufferRange.inputStart  += bufferRange.inputLength;
     bufferRange.totalLength -= bufferRange.inputLength;
     bufferRange.inputLength = 0;
 
-    std::size_t result     = 0;
+    std::size_t result      = std::min(bufferRange.totalLength, size);
 
-    if (localBuffer != nullptr)
-    {
-        result      = std::min(bufferRange.totalLength, size);
+    std::copy(bufferRange.inputStart, bufferRange.inputStart + result, localBuffer);
+    bufferRange.inputStart  += result;
+    bufferRange.totalLength -= result;
+
+    return result;
+}
+
+std::size_t ProtocolHTTP::getMessageDataFromStream(char* localBuffer, std::size_t size)
+{
+    // Reading the Body.
+    // There is no reason to stop just read as much as possible.
+    return socket.getMessageData(localBuffer, size, [](std::size_t){return false;});
+}
 
-        std::copy(bufferRange.inputStart, bufferRange.inputStart + result, localBuffer);
-        bufferRange.totalLength -= result;
+/*
+ * Read the body of a chunked message.
+ * The size lines and terminators are removed so the caller only sees
+ * the data. Returns 0 after the last chunk (and any trailers) is read.
+ *
+ * The chunk data itself is read with getMessageDataRaw() limited to
+ * the remains of the current chunk so it never reads past it.
+ */
+std::size_t ProtocolHTTP::getMessageChunkData(char* localBuffer, std::size_t size)
+{
+    if (size == 0)
+    {
+        return 0;
     }
-    else
+    if (chunkRemaining == 0)
     {
-        auto begOfRange = bufferRange.inputStart;
-        auto endOfRange = bufferRange.inputStart + bufferRange.totalLength;
-        auto find       = std::search(begOfRange, endOfRange, endOfLineSeq, endOfLineSeq + 2);
-        if (find != endOfRange)
+        if (chunkDone)
         {
-            bufferRange.inputLength = find + 2 - bufferRange.inputStart;
-            result  = bufferRange.inputLength;
+            return 0;
         }
-        else
+        if (!chunkFirst)
         {
-            // We found some of a header or the method in the buffer
-            // But it was not the whole line. So move this fragment to
-            // the beginning of the buffer and return 0 to indicate
-            // that not a complete line was read. This will result in
-            // a call to getMessageDataFromStream()
-            std::copy(begOfRange, endOfRange, &bufferData[0]);
-            bufferRange.inputStart = &bufferData[0];
+            // The "\r\n" after the previous chunk's data.
+            char const* begin;
+            char const* end;
+            getMessageLine(begin, end);
+            if (begin != end)
+            {
+                throw HTTPParseError(buildErrorMessage("ProtocolHTTP::", __func__, ": Chunk data not terminated by \\r\\n"));
+            }
+        }
+        chunkFirst      = false;
+        chunkRemaining  = getMessageChunkSize();
+        if (chunkRemaining == 0)
+        {
+            chunkDone   = true;
+            return 0;
         }
     }
 
+    std::size_t result  = getMessageDataRaw(localBuffer, std::min(size, chunkRemaining));
+    if (result == 0)
+    {
+        throw std::runtime_error(buildErrorMessage("ProtocolHTTP::", __func__, ": Connection closed inside chunk"));
+    }
+    chunkRemaining -= result;
     return result;
 }
 
-std::size_t ProtocolHTTP::getMessageDataFromStream(char* localBuffer, std::size_t size)
+/*
+ * Read a chunk size line: <hex digits>[;extensions]\r\n
+ * The extensions are ignored.
+ * After the last chunk (size 0) the trailer fields are read (and ignored)
+ * up to the empty line that ends the message.
+ */
+std::size_t ProtocolHTTP::getMessageChunkSize()
 {
-    char*           buffer    = localBuffer ? localBuffer : bufferRange.inputStart;
-    std::size_t     dataRead  = localBuffer ? 0           : bufferRange.totalLength;
-    std::size_t     dataMax   = localBuffer ? size        : bufferSize - (bufferRange.inputStart - &bufferData[0]);
-    char*           lastCheck = buffer + (dataRead ? dataRead - 1 : 0);
-    BufferRange&    br        = bufferRange;
+    char const* begin;
+    char const* end;
+    getMessageLine(begin, end);
 
-    return socket.getMessageData(buffer + dataRead, dataMax, [localBuffer, &br, buffer, &lastCheck, dataRead](std::size_t readSoFar)
+    char const* sizeEnd = std::find(begin, end, ';');
+    HTTPScanner::trim(begin, sizeEnd);
+    if (begin == sizeEnd || sizeEnd - begin > static_cast<std::ptrdiff_t>(sizeof(std::size_t) * 2))
+    {
+        throw HTTPParseError(buildErrorMessage("ProtocolHTTP::", __func__, ": Invalid chunk size: ", std::string(begin, end)));
+    }
+    std::size_t size = 0;
+    for(char const* digit = begin; digit != sizeEnd; ++digit)
     {
-        // Reading the Body.
-        // There is no reason to stop just read as much as possible.
-        if (localBuffer != nullptr)
+        char c = *digit;
+        int  value;
+        if (c >= '0' && c <= '9')       {value = c - '0';}
+        else if (c >= 'a' && c <= 'f')  {value = c - 'a' + 10;}
+        else if (c >= 'A' && c <= 'F')  {value = c - 'A' + 10;}
+        else
         {
-            return false;
+            throw HTTPParseError(buildErrorMessage("ProtocolHTTP::", __func__, ": Invalid chunk size: ", std::string(begin, end)));
         }
+        size = size * 16 + value;
+    }
 
-        // Reading the status line or one of the headers.
-        // So once we have a line in the buffer stop reading and processes it.
-        auto totalDataRead = dataRead + readSoFar;
-        auto find = std::search(lastCheck, buffer + totalDataRead, endOfLineSeq, endOfLineSeq + 2);
-        if (find != buffer + totalDataRead)
+    if (size == 0)
+    {
+        // Skip the trailer.
+        do
         {
-            br.inputLength = find + 2 - buffer;
-            br.totalLength += readSoFar;
-            return true;
+            getMessageLine(begin, end);
         }
-        lastCheck = find - 1;
-        return false;
-    });
+        while(begin != end);
+    }
+    return size;
 }
 
+/*
+ * Get the next "\r\n" terminated line from the internal buffer
+ * reading more data from the socket as required.
+ *
+ * The message head is preserved (the message view refers to it) so the
+ * line can use the rest of the ring up to the start of the head.
+ * Only if a partial line reaches the head is it moved down to the
+ * end of the head to make space.
+ */
+void ProtocolHTTP::getMessageLine(char const*& begin, char const*& end)
+{
+    // Discard the message head.
+    bufferRange.inputStart  += bufferRange.inputLength;
+    bufferRange.totalLength -= bufferRange.inputLength;
+    bufferRange.inputLength = 0;
+
+    char*       bodyStart   = messageStart + headSize;
+    char*       bodyEnd     = messageStart + bufferSize;
+    std::size_t searched    = 0;
+    while(true)
+    {
+        char*   dataEnd = bufferRange.inputStart + bufferRange.totalLength;
+        char*   lineEnd = std::find(bufferRange.inputStart + searched, dataEnd, '\n');
+        if (lineEnd != dataEnd)
+        {
+            if (lineEnd == bufferRange.inputStart || lineEnd[-1] != '\r')
+            {
+                throw HTTPParseError(buildErrorMessage("ProtocolHTTP::", __func__, ": Chunk line not terminated by \\r\\n"));
+            }
+            begin   = bufferRange.inputStart;
+            end     = lineEnd - 1;
+            bufferRange.totalLength -= (lineEnd + 1 - bufferRange.inputStart);
+            bufferRange.inputStart  = lineEnd + 1;
+            return;
+        }
+        searched = bufferRange.totalLength;
+
+        if (bufferRange.totalLength == 0)
+        {
+            bufferRange.inputStart = bodyStart;
+        }
+        else if (dataEnd == bodyEnd && bufferRange.inputStart != bodyStart)
+        {
+            // Move the partial line down so there is space to read more.
+            std::copy(bufferRange.inputStart, dataEnd, bodyStart);
+            bufferRange.inputStart = bodyStart;
+        }
+        std::size_t space = bodyEnd - (bufferRange.inputStart + bufferRange.totalLength);
+        if (space == 0)
+        {
+            throw HTTPParseError(buildErrorMessage("ProtocolHTTP::", __func__, ": Chunk line larger than buffer: ", bufferSize));
+        }
+        std::size_t got = socket.getMessageData(bufferRange.inputStart + bufferRange.totalLength, space, [](std::size_t){return true;});
+        if (got == 0)
+        {
+            throw std::runtime_error(buildErrorMessage("ProtocolHTTP::", __func__, ": Connection closed inside chunked body"));
+        }
+        bufferRange.totalLength += got;
+    }
+}
@@ -3,8 +3,17 @@
 #define THORSANVIL_SOCKET_PROTOCOL_HTTP_H
 
 #include "Protocol.h"
+#include "HTTPScanner.h"
+#include "HTTPMessageView.h"
+#include "BufferPool.h"
+#include "ConnectionPool.h"
+#include "ResponseCache.h"
 #include <vector>
+#include <deque>
+#include <chrono>
 #include <sstream>
+#include <sys/uio.h>
+#include <sys/types.h>
 
 namespace ThorsAnvil
 {
@@ -20,8 +29,8 @@ class ProtocolHTTP: public Protocol
         char*       inputStart;
         std::size_t inputLength;
         std::size_t totalLength;
-        BufferRange(std::vector<char>& buffer)
-            : inputStart(&buffer[0])
+        BufferRange(BufferPool::Buffer& buffer)
+            : inputStart(buffer.data())
             , inputLength(0)
             , totalLength(0)
         {}
@@ -33,51 +42,215 @@ class ProtocolHTTP: public Protocol
             swap(totalLength, rhs.totalLength);
         }
     };
-    static constexpr char const* endOfLineSeq = "\r\n";
-    static constexpr std::size_t bufferSize   = 4096;
-    std::vector<char>           bufferData;
+    // Taken from (and returned to) a BufferPool.
+    // So connection churn does not churn the allocator.
+    BufferPool::Buffer          bufferData;
+    std::size_t                 bufferSize;
     BufferRange                 bufferRange;
+    HTTPScanner                 scanner;
+    HTTPMessageView             messageView;
+    // The current message head is [messageStart, messageStart + headSize).
+    char*                       messageStart;
+    std::size_t                 headSize;
+    bool                        connectionKeepAlive;
+    // State of the "Transfer-Encoding: chunked" body being read.
+    bool                        chunkedBody;
+    bool                        chunkFirst;
+    bool                        chunkDone;
+    std::size_t                 chunkRemaining;
+    // The parts of the message being sent.
+    // Gathered so the whole message is sent with a single writev().
+    std::vector<iovec>          messageParts;
+    std::deque<std::string>     messageStore;
+    // The size line of the chunk being sent: <hex size>\r\n
+    char                        chunkSizeLine[sizeof(std::size_t) * 2 + 2];
 
     protected:
-        char const*   begin()   const   {return bufferRange.inputStart;}
-        char const*   end()     const   {return bufferRange.inputStart + bufferRange.inputLength;}
+        // Passed as the body size when the body is sent/received
+        // with "Transfer-Encoding: chunked".
+        static constexpr std::size_t chunkedSize = static_cast<std::size_t>(-1);
+
+        // The first line of the message (without the "\r\n").
+        char const*   startLineBegin()  const   {return bufferRange.inputStart + scanner.getLines()[0].begin;}
+        char const*   startLineEnd()    const   {return bufferRange.inputStart + scanner.getLines()[0].end;}
 
         virtual RequestType getRequestType() const = 0;
+        HTTPMessageView&    getMessageViewForUpdate()   {return messageView;}
 
+        // Add data to the message being sent.
+        // Nothing is written until putMessageEnd() is called.
+        // Note: Literals and `item` references are not copied so must stay
+        //       valid until putMessageEnd(). Temporaries are moved into the message.
+        void        putMessageData(char const* literal);
+        void        putMessageData(char const* data, std::size_t size);
         void        putMessageData(std::string const& item);
+        void        putMessageData(std::string&& item);
+        // Send what has been added so far.
+        // `more`: More of the message follows at once (so the data is not sent as a short packet).
+        void        putMessageFlush(bool more = false);
+        void        putMessageEnd();
+        // Send one chunk of a chunked body (and anything already added).
+        // An empty chunk is ignored as it would terminate the body.
+        void        putMessageChunk(std::string const& chunk);
+        // Send the terminating chunk.
+        void        putMessageChunkEnd();
         std::size_t getMessageData(char* localBuffer, std::size_t size);
 
+        // Read the start line and headers of the next message.
+        // Returns the size of the body (see getMessageBody()).
+        std::size_t recvMessageHead();
+        std::size_t getMessageHead();
         virtual int         getMessageStartLine() = 0;
         std::size_t getMessageHeader(int responseCode);
         void        getMessageBody(std::size_t bodySize, std::string& message);
+        void        getMessageBody(std::size_t bodySize, MessageSink const& sink);
 
         std::size_t getMessageDataFromStream(char* buffer, std::size_t size);
         std::size_t getMessageDataFromBuffer(char* localBuffer, std::size_t size);
 
+        std::size_t getMessageDataRaw(char* localBuffer, std::size_t size);
+        std::size_t getMessageChunkData(char* localBuffer, std::size_t size);
+        std::size_t getMessageChunkSize();
+        void        getMessageLine(char const*& begin, char const*& end);
+        // Data has been read from the socket that is not part of a message yet.
+        bool        hasUnreadInput() const  {return bufferRange.inputLength != 0;}
+
     public:
         void recvMessage(std::string& message)                               override;
-        ProtocolHTTP(DataSocket& socket);
+        void recvMessage(MessageSink const& sink)                            override;
+        // The input buffer is taken from `pool`.
+        // Its buffer size limits the size of the message head.
+        ProtocolHTTP(DataSocket& socket, BufferPool& pool = BufferPool::forThread());
+
+        // HTTP/1.1 connections are persistent by default.
+        // The connection is closed after the current exchange if either
+        // side sends "Connection: close" (see setKeepAlive()) or the
+        // length of a body could only be determined by closing the stream.
+        bool keepAlive() const              {return connectionKeepAlive;}
+        void setKeepAlive(bool keepAlive)   {connectionKeepAlive = connectionKeepAlive && keepAlive;}
+
+        // Returns true if there is another message to read on this connection.
+        // Data from a pipelined request that has already been read is used
+        // before waiting on the socket. Returns false if the connection is
+        // not being kept alive or the other end closed it.
+        bool hasMessage();
+
+        // The start line and headers of the last message received.
+        // The view refers directly to the input buffer (nothing is copied)
+        // so it is only valid until the next call to hasMessage() or recvMessage().
+        HTTPMessageView const& getMessageView() const   {return messageView;}
 
 };
 
+// Serves requests on an accepted connection.
+//
+// The counters in Metrics are updated as requests are served (connections,
+// requests, parse errors and the first byte/parse/send latencies).
+// A GET of a reserved URL is answered here and never returned by recvMessage():
+//      metricsUrl      All the metrics in the Prometheus text format.
+//      traceUrl        The events recorded by Trace (Chrome trace JSON).
 class HTTPServer: public ProtocolHTTP
 {
+    using Clock = std::chrono::steady_clock;
     private:
+        static constexpr char const serverHead[] = "Server: ThorsExperimental-Server/0.1\r\n";
+
+        // Holds the parts of the response head that change per response
+        // (Date and Content-Length) while it is being sent.
+        //      "Date: " + date + "\r\nContent-Length: " + 20 digits + "\r\n"
+        char        responseHead[80];
+        // The connection was opened (accepted) at `created` (see DataSocket::getOpenTime()).
+        // Note: Not when this object was created; an EventLoop only starts the task once data arrives.
+        // The current request was first seen at `requestStart`.
+        Clock::time_point   created;
+        Clock::time_point   requestStart;
+        Clock::time_point   sendStart;
+        bool        firstRequest;
+        // hasMessage() has read the head of the next request.
+        bool        headPending;
+        std::size_t pendingBodySize;
+
         int         getMessageStartLine() override;
         RequestType getRequestType() const override {return Response;}
+        void        putMessageHeaders(std::size_t bodySize, char const* contentType = "Content-Type: text/text\r\n", char const* statusLine = "HTTP/1.1 200 OK\r\n");
+        bool        nextRequest();
+        void        startRequest();
+        std::size_t takeRequestHead();
+        void        endRequest();
+        void        sendReserved(std::string&& body, char const* contentType);
     public:
-        using ProtocolHTTP::ProtocolHTTP;
+        static constexpr char const metricsUrl[] = "/metrics";
+        static constexpr char const traceUrl[]   = "/trace";
+
+        HTTPServer(DataSocket& socket, BufferPool& pool = BufferPool::forThread());
+        ~HTTPServer();
+
+        // See ProtocolHTTP::hasMessage().
+        // Requests for a reserved URL are served before returning.
+        bool hasMessage();
+        void recvMessage(std::string& message)                               override;
+        void recvMessage(MessageSink const& sink)                            override;
         void sendMessage(std::string const& url, std::string const& message) override;
+        // Send an error response (with no body): 400, 404, 405, 500, 501 or 503.
+        // `headers` are added to the response head (each ends with "\r\n").
+        void sendError(int status, std::string&& headers = std::string());
+        // Send a response built by a ResponseCache.
+        // The prebuilt bytes are sent as they are (with the Date) by a single writev().
+        void sendCached(ResponseCache::Entry const& entry);
+        // Append the head of a "200 OK" response without the Date or the
+        // "Connection" header or the blank line that ends it (see ResponseCache).
+        static void appendFixedHead(std::string& output, std::size_t bodySize, char const* contentType);
+        // Send `size` bytes of the open file `fileId` starting at `offset` as the body.
+        void sendFile(std::string const& url, int fileId, off_t offset, std::size_t size);
+
+        // Stream a response whose size is not known in advance
+        // using "Transfer-Encoding: chunked":
+        //      sendMessageStart(url);
+        //      sendMessageChunk(part);     // repeat as parts are generated
+        //      sendMessageEnd();
+        // The headers are sent with the first chunk.
+        void sendMessageStart(std::string const& url);
+        void sendMessageChunk(std::string const& chunk)    {putMessageChunk(chunk);}
+        void sendMessageEnd();
 };
 
-class HTTPClient: public ProtocolHTTP
+// The connection an HTTPClient borrowed from a ConnectionPool (if any).
+// A base class (rather than a member) so it is constructed before the
+// ProtocolHTTP that uses its socket.
+struct HTTPClientConnection
+{
+    ConnectionPool::Connection  connection;
+};
+
+class HTTPClient: private HTTPClientConnection, public ProtocolHTTP
 {
     private:
+        // The request line and headers of the request being sent.
+        // Reused so its capacity is only allocated once per connection.
+        std::string requestHead;
+        // Requests sent whose response has not been read.
+        std::size_t responsesPending;
+
         int         getMessageStartLine() override;
         virtual std::string const& getHost() const = 0;
+        void        putMessageHeaders(std::string const& url, std::size_t bodySize);
     public:
-        using ProtocolHTTP::ProtocolHTTP;
+        HTTPClient(DataSocket& socket, BufferPool& pool = BufferPool::forThread());
+        // Use a connection from a ConnectionPool.
+        // It is given back to the pool on destruction if every response
+        // has been read and the connection is being kept alive.
+        HTTPClient(ConnectionPool::Connection&& connection, BufferPool& pool = BufferPool::forThread());
+        ~HTTPClient();
+
+        void recvMessage(std::string& message)                               override;
+        void recvMessage(MessageSink const& sink)                            override;
         void sendMessage(std::string const& url, std::string const& message) override;
+
+        // Stream a request body with "Transfer-Encoding: chunked".
+        // See HTTPServer::sendMessageStart().
+        void sendMessageStart(std::string const& url);
+        void sendMessageChunk(std::string const& chunk)    {putMessageChunk(chunk);}
+        void sendMessageEnd()                               {putMessageChunkEnd();}
 };
 
 class HTTPPost: public HTTPClient
@@ -91,6 +264,10 @@ class HTTPPost: public HTTPClient
             : HTTPClient(socket)
             , host(host)
         {}
+        HTTPPost(std::string const& host, ConnectionPool::Connection&& connection)
+            : HTTPClient(std::move(connection))
+            , host(host)
+        {}
 };
 
 
@@ -0,0 +1,189 @@
+
+#include "ResponseCache.h"
+#include "ProtocolHTTP.h"
+#include "EventLoop.h"
+#include "Utility.h"
+
+using namespace ThorsAnvil::Socket;
+
+ResponseCache::ResponseCache(std::size_t maxEntries, std::size_t maxBytes, Clock::duration ttl, Clock::duration maxWait)
+    : maxEntries(maxEntries)
+    , maxBytes(maxBytes)
+    , ttl(ttl)
+    , maxWait(maxWait)
+    , stats{0, 0, 0, 0, 0, 0, 0, 0}
+{}
+
+/*
+ * A hit only holds the lock to find the entry and move it to the front
+ * of the LRU list. The body is built (or waited for) without the lock.
+ */
+ResponseCache::EntryPtr ResponseCache::get(std::string_view method, std::string_view url, Body const& body, char const* contentType)
+{
+    // Reused so a hit does not allocate.
+    thread_local std::string    lookup;
+    lookup.clear();
+    appendStringParts(lookup, method, ' ', url);
+
+    std::promise<EntryPtr>          promise;
+    std::shared_future<EntryPtr>    wait;
+    bool                            builder = false;
+    {
+        std::lock_guard<std::mutex>     lock(mutex);
+        auto find = entries.find(lookup);
+        if (find != std::end(entries))
+        {
+            if (Clock::now() < find->second.entry->expires)
+            {
+                ++stats.hits;
+                lru.splice(std::begin(lru), lru, find->second.use);
+                return find->second.entry;
+            }
+            ++stats.expired;
+            erase(find);
+        }
+
+        auto building = pending.find(lookup);
+        if (building == std::end(pending))
+        {
+            ++stats.misses;
+            builder = true;
+            pending.emplace(lookup, Pending{std::this_thread::get_id(), promise.get_future().share()});
+        }
+        else if (building->second.builder != std::this_thread::get_id())
+        {
+            ++stats.coalesced;
+            wait = building->second.result;
+        }
+        else
+        {
+            ++stats.misses;
+        }
+    }
+    // `body` may use the cache (and so `lookup`).
+    // As may other tasks on this thread while this one is paused.
+    std::string key = lookup;
+    if (wait.valid())
+    {
+        // An EventLoop task is paused (the loop runs its other connections).
+        // Any other thread simply waits on the future.
+        Clock::time_point   giveUp  = Clock::now() + maxWait;
+        while(wait.wait_for(Clock::duration::zero()) != std::future_status::ready && Clock::now() < giveUp)
+        {
+            if (!EventLoop::pause(std::chrono::milliseconds(waitPoll)))
+            {
+                wait.wait_until(giveUp);
+            }
+        }
+        if (wait.wait_for(Clock::duration::zero()) == std::future_status::ready)
+        {
+            // Rethrows if the builder failed.
+            return wait.get();
+        }
+        // The builder is too slow (or is waiting for us): build it here.
+        std::lock_guard<std::mutex>     lock(mutex);
+        ++stats.abandoned;
+    }
+
+    EntryPtr    entry;
+    try
+    {
+        entry = build(body, contentType);
+    }
+    catch(...)
+    {
+        if (builder)
+        {
+            {
+                std::lock_guard<std::mutex>     lock(mutex);
+                pending.erase(key);
+            }
+            promise.set_exception(std::current_exception());
+        }
+        throw;
+    }
+    {
+        std::lock_guard<std::mutex>     lock(mutex);
+        insert(key, entry);
+        if (builder)
+        {
+            pending.erase(key);
+        }
+    }
+    if (builder)
+    {
+        promise.set_value(entry);
+    }
+    return entry;
+}
+
+ResponseCache::EntryPtr ResponseCache::build(Body const& body, char const* contentType) const
+{
+    std::string             content = body();
+    std::shared_ptr<Entry>  entry   = std::make_shared<Entry>();
+    HTTPServer::appendFixedHead(entry->wire, content.size(), contentType);
+    entry->headSize = entry->wire.size();
+    appendStringParts(entry->wire, "\r\n", content);
+    entry->expires  = Clock::now() + ttl;
+    return entry;
+}
+
+// Called with the lock held.
+void ResponseCache::insert(std::string const& key, EntryPtr const& entry)
+{
+    std::size_t size = key.size() + entry->size();
+    if (size > maxBytes || maxEntries == 0)
+    {
+        return;
+    }
+    auto find = entries.find(key);
+    if (find != std::end(entries))
+    {
+        erase(find);
+    }
+    lru.push_front(key);
+    entries.emplace(key, Cached{entry, std::begin(lru)});
+    ++stats.entries;
+    stats.bytes += size;
+
+    while(stats.entries > maxEntries || stats.bytes > maxBytes)
+    {
+        ++stats.evictions;
+        erase(entries.find(lru.back()));
+    }
+}
+
+// Called with the lock held.
+void ResponseCache::erase(std::unordered_map<std::string, Cached>::iterator find)
+{
+    --stats.entries;
+    stats.bytes -= find->first.size() + find->second.entry->size();
+    lru.erase(find->second.use);
+    entries.erase(find);
+}
+
+void ResponseCache::invalidate(std::string_view method, std::string_view url)
+{
+    std::string                     key = buildStringFromParts(method, ' ', url);
+    std::lock_guard<std::mutex>     lock(mutex);
+    auto find = entries.find(key);
+    if (find != std::end(entries))
+    {
+        erase(find);
+    }
+}
+
+void ResponseCache::clear()
+{
+    std::lock_guard<std::mutex>     lock(mutex);
+    entries.clear();
+    lru.clear();
+    stats.entries   = 0;
+    stats.bytes     = 0;
+}
+
+ResponseCache::Stats ResponseCache::getStats()
+{
+    std::lock_guard<std::mutex>     lock(mutex);
+    return stats;
+}
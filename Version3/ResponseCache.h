@@ -0,0 +1,133 @@
+
+#ifndef THORSANVIL_SOCKET_RESPONSE_CACHE_H
+#define THORSANVIL_SOCKET_RESPONSE_CACHE_H
+
+#include <list>
+#include <mutex>
+#include <memory>
+#include <string>
+#include <thread>
+#include <chrono>
+#include <future>
+#include <cstddef>
+#include <functional>
+#include <string_view>
+#include <unordered_map>
+
+namespace ThorsAnvil
+{
+    namespace Socket
+    {
+
+// A cache of complete HTTP responses keyed by method and url.
+//
+// An entry holds the response already serialized (status line, headers
+// and body) so a hit is sent by HTTPServer::sendCached() with a single
+// writev() and nothing is formatted or copied. Only the Date (and the
+// optional "Connection: close") are added as the response is sent.
+//
+// Entries expire `ttl` after they are built. When the cache holds more
+// than `maxEntries` entries or `maxBytes` bytes the least recently used
+// entries are evicted. A response larger than `maxBytes` is not cached.
+//
+// When several threads miss on the same key at the same time only the
+// first builds the body; the others wait for it and share the result.
+// Note: A miss on the thread that is already building the key (ie another
+//       EventLoop task on the same thread) builds the body itself rather
+//       than waiting as waiting would block the thread doing the work.
+// Waiting does not block the thread: a caller on an EventLoop task is paused
+// (see EventLoop::pause()) so the loop keeps serving its other connections.
+// A waiter gives up after `maxWait` and builds the body itself (uncoalesced).
+// This bounds the cost of a stalled builder and breaks the cycle when two
+// bodies each wait for a key the other is building.
+//
+// Thread safe: One cache can be shared by all the worker threads.
+class ResponseCache
+{
+    public:
+        using Clock     = std::chrono::steady_clock;
+        // Builds the body of the response (called on a miss).
+        using Body      = std::function<std::string()>;
+
+        // Immutable once built so it can be sent while it is evicted.
+        class Entry
+        {
+            friend class ResponseCache;
+            // "HTTP/1.1 200 OK\r\n" ... "Content-Length: <n>\r\n" | "\r\n" <body>
+            std::string         wire;
+            std::size_t         headSize;
+            Clock::time_point   expires;
+            public:
+                // The head up to (not including) the Date.
+                std::string_view    head()  const   {return std::string_view(wire.data(), headSize);}
+                // The blank line that ends the head and the body.
+                std::string_view    tail()  const   {return std::string_view(wire.data() + headSize, wire.size() - headSize);}
+                std::size_t         size()  const   {return wire.size();}
+        };
+        using EntryPtr  = std::shared_ptr<Entry const>;
+
+        struct Stats
+        {
+            std::size_t     hits;
+            std::size_t     misses;     // The body was built.
+            std::size_t     coalesced;  // Waited for another thread to build the body.
+            std::size_t     abandoned;  // Of those: gave up after maxWait and built it too.
+            std::size_t     expired;
+            std::size_t     evictions;
+            std::size_t     entries;    // Current size.
+            std::size_t     bytes;
+        };
+
+        static constexpr std::size_t    defaultMaxEntries   = 1024;
+        static constexpr std::size_t    defaultMaxBytes     = 64 * 1024 * 1024;
+        static constexpr int            defaultTTL          = 60;   // seconds
+        static constexpr int            defaultMaxWait      = 1000; // milliseconds
+        static constexpr int            waitPoll            = 1;    // milliseconds: A paused waiter checks this often.
+    private:
+        struct Cached
+        {
+            EntryPtr                        entry;
+            std::list<std::string>::iterator use;   // Position in `lru`.
+        };
+        // A body being built.
+        struct Pending
+        {
+            std::thread::id                 builder;
+            std::shared_future<EntryPtr>    result;
+        };
+
+        std::size_t                                 maxEntries;
+        std::size_t                                 maxBytes;
+        Clock::duration                             ttl;
+        Clock::duration                             maxWait;
+        std::mutex                                  mutex;
+        std::unordered_map<std::string, Cached>     entries;
+        std::unordered_map<std::string, Pending>    pending;
+        // Keys: most recently used at the front.
+        std::list<std::string>                      lru;
+        Stats                                       stats;
+
+        EntryPtr    build(Body const& body, char const* contentType) const;
+        void        insert(std::string const& key, EntryPtr const& entry);
+        void        erase(std::unordered_map<std::string, Cached>::iterator find);
+    public:
+        ResponseCache(std::size_t maxEntries = defaultMaxEntries, std::size_t maxBytes = defaultMaxBytes, Clock::duration ttl = std::chrono::seconds(defaultTTL),
+                      Clock::duration maxWait = std::chrono::milliseconds(defaultMaxWait));
+        ResponseCache(ResponseCache const&)             = delete;
+        ResponseCache& operator=(ResponseCache const&)  = delete;
+
+        // Returns the cached response for method/url.
+        // On a miss `body` is called to build it (a "200 OK" with `contentType`).
+        // If `body` throws the exception is passed to every caller waiting on it
+        // (and nothing is cached).
+        EntryPtr    get(std::string_view method, std::string_view url, Body const& body, char const* contentType = "Content-Type: text/text\r\n");
+        void        invalidate(std::string_view method, std::string_view url);
+        void        clear();
+
+        Stats       getStats();
+};
+
+    }
+}
+
+#endif
@@ -0,0 +1,240 @@
+
+#include "Router.h"
+#include "Utility.h"
+#include <algorithm>
+
+using namespace ThorsAnvil::Socket;
+
+namespace
+{
+    // Indexed by RequestType.
+    char const* const methodName[] = {"", "HEAD", "GET", "PUT", "POST", "DELETE"};
+}
+
+RequestType Router::requestType(std::string_view method)
+{
+    for(std::size_t loop = Head; loop < methodCount; ++loop)
+    {
+        if (method == methodName[loop])
+        {
+            return static_cast<RequestType>(loop);
+        }
+    }
+    return Response;
+}
+
+Router::Router()
+    : staticRoutes(nullptr)
+    , staticSlots(nullptr)
+    , staticMask(0)
+{
+    nodes.emplace_back("");
+}
+
+/*
+ * Building the trie:
+ *      The path is split into static text and parameters.
+ *      The static text follows (and splits) the existing nodes
+ *      so that each node's children start with different characters.
+ */
+void Router::add(RequestType method, std::string_view path, RouteHandler handler)
+{
+    if (method == Response || method >= static_cast<RequestType>(methodCount) || handler == nullptr || !Route::validPath(path))
+    {
+        throw std::logic_error(buildErrorMessage("Router::", __func__, ": Invalid route: ", path));
+    }
+    std::size_t index   = 0;
+    std::size_t pos     = 0;
+    while(pos < path.size())
+    {
+        std::size_t param   = std::min(path.find(':', pos), path.size());
+        index   = addStatic(index, path.substr(pos, param - pos));
+        if (param == path.size())
+        {
+            break;
+        }
+        pos     = std::min(path.find('/', param), path.size());
+        index   = addParam(index, path.substr(param + 1, pos - param - 1));
+    }
+    if (nodes[index].handlers[method] != nullptr)
+    {
+        throw std::logic_error(buildErrorMessage("Router::", __func__, ": Duplicate route: ", methodName[method], " ", path));
+    }
+    nodes[index].handlers[method] = handler;
+}
+
+// Returns the node where `text` ends.
+std::size_t Router::addStatic(std::size_t index, std::string_view text)
+{
+    while(!text.empty())
+    {
+        std::size_t found = 0;
+        for(std::size_t child: nodes[index].children)
+        {
+            if (nodes[child].label[0] == text[0])
+            {
+                found = child;
+                break;
+            }
+        }
+        if (found == 0)
+        {
+            nodes.emplace_back(text);
+            nodes[index].children.push_back(nodes.size() - 1);
+            return nodes.size() - 1;
+        }
+
+        std::string const&  label   = nodes[found].label;
+        std::size_t         common  = std::mismatch(std::begin(label), std::end(label), std::begin(text), std::end(text)).first - std::begin(label);
+        if (common != label.size())
+        {
+            // Split the child: a new node holds the common prefix
+            // and the child is left with the rest of its label.
+            Node    split(std::string_view(label).substr(0, common));
+            split.children.push_back(found);
+            nodes[found].label.erase(0, common);
+            nodes.push_back(std::move(split));
+
+            std::vector<std::size_t>& children = nodes[index].children;
+            *std::find(std::begin(children), std::end(children), found) = nodes.size() - 1;
+            found   = nodes.size() - 1;
+        }
+        text.remove_prefix(common);
+        index = found;
+    }
+    return index;
+}
+
+std::size_t Router::addParam(std::size_t index, std::string_view name)
+{
+    std::size_t param = nodes[index].param;
+    if (param == 0)
+    {
+        nodes.emplace_back(name);
+        param = nodes[index].param = nodes.size() - 1;
+    }
+    else if (nodes[param].label != name)
+    {
+        throw std::logic_error(buildErrorMessage("Router::", __func__, ": Parameter :", name, " conflicts with :", nodes[param].label));
+    }
+    return param;
+}
+
+RouteHandler Router::find(RequestType method, std::string_view path, RouteParams& params, unsigned int& allowed) const
+{
+    path        = path.substr(0, path.find('?'));
+    params.count= 0;
+    allowed     = 0;
+
+    if (Route const* route = findStatic(method, path))
+    {
+        allowed = 1u << method;
+        return route->handler;
+    }
+    Node const* node = findNode(0, path, params);
+    if (node == nullptr)
+    {
+        return nullptr;
+    }
+    for(std::size_t loop = 0; loop < methodCount; ++loop)
+    {
+        allowed |= node->handlers[loop] != nullptr ? 1u << loop : 0;
+    }
+    return node->handlers[method];
+}
+
+// A linear probe of the RouteTable hash table.
+Route const* Router::findStatic(RequestType method, std::string_view path) const
+{
+    if (staticSlots == nullptr)
+    {
+        return nullptr;
+    }
+    for(std::size_t slot = Route::hash(method, path) & staticMask; staticSlots[slot] != 0; slot = (slot + 1) & staticMask)
+    {
+        Route const& route = staticRoutes[staticSlots[slot] - 1];
+        if (route.method == method && route.path == path)
+        {
+            return &route;
+        }
+    }
+    return nullptr;
+}
+
+/*
+ * `path` is what is left after the label of `nodes[index]`.
+ * A static child is tried first then the parameter (which takes
+ * the rest of the segment). Returns the node with handlers where
+ * the path ends or nullptr.
+ */
+Router::Node const* Router::findNode(std::size_t index, std::string_view path, RouteParams& params) const
+{
+    Node const& node = nodes[index];
+    if (path.empty())
+    {
+        bool hasHandler = std::any_of(std::begin(node.handlers), std::end(node.handlers), [](RouteHandler handler){return handler != nullptr;});
+        return hasHandler ? &node : nullptr;
+    }
+    for(std::size_t child: node.children)
+    {
+        std::string const& label = nodes[child].label;
+        if (label[0] == path[0])
+        {
+            if (path.compare(0, label.size(), label) == 0)
+            {
+                if (Node const* find = findNode(child, path.substr(label.size()), params))
+                {
+                    return find;
+                }
+            }
+            break;
+        }
+    }
+    if (node.param != 0)
+    {
+        std::size_t end     = std::min(path.find('/'), path.size());
+        std::size_t count   = params.count;
+        if (end != 0 && count != RouteParams::maxParams)
+        {
+            params.params[count] = {nodes[node.param].label, path.substr(0, end)};
+            params.count = count + 1;
+            if (Node const* find = findNode(node.param, path.substr(end), params))
+            {
+                return find;
+            }
+            params.count = count;
+        }
+    }
+    return nullptr;
+}
+
+bool Router::dispatch(HTTPServer& server, std::string const& body) const
+{
+    HTTPMessageView const&  view    = server.getMessageView();
+    RouteParams             params;
+    unsigned int            allowed;
+    RouteHandler            handler = find(requestType(view.getMethod()), view.getUrl(), params, allowed);
+    if (handler != nullptr)
+    {
+        handler(server, params, body);
+        return true;
+    }
+    if (allowed == 0)
+    {
+        server.sendError(404);
+        return false;
+    }
+    std::string allow   = "Allow:";
+    char const* separator = " ";
+    for(std::size_t loop = Head; loop < methodCount; ++loop)
+    {
+        if (allowed & (1u << loop))
+        {
+            appendStringParts(allow, separator, methodName[loop]);
+            separator = ", ";
+        }
+    }
+    appendStringParts(allow, "\r\n");
+    server.sendError(405, std::move(allow));
+    return false;
+}
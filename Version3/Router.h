@@ -0,0 +1,265 @@
+
+#ifndef THORSANVIL_SOCKET_ROUTER_H
+#define THORSANVIL_SOCKET_ROUTER_H
+
+#include "ProtocolHTTP.h"
+#include <array>
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+#include <stdexcept>
+#include <string_view>
+
+namespace ThorsAnvil
+{
+    namespace Socket
+    {
+
+// The values of the parameters (":name" segments) of the matched route.
+// The names refer to the route and the values to the request url
+// (so they are only valid as long as the request's HTTPMessageView).
+class RouteParams
+{
+    public:
+        static constexpr std::size_t maxParams = 8;
+        struct Param
+        {
+            std::string_view    name;
+            std::string_view    value;
+        };
+    private:
+        std::array<Param, maxParams>    params;
+        std::size_t                     count;
+
+        friend class Router;
+    public:
+        RouteParams()
+            : count(0)
+        {}
+
+        std::size_t     size()  const   {return count;}
+        Param const*    begin() const   {return params.data();}
+        Param const*    end()   const   {return params.data() + count;}
+        // Returns the value of the parameter `name` (empty if there is none).
+        std::string_view operator[](std::string_view name) const
+        {
+            for(Param const& param: *this)
+            {
+                if (param.name == name)
+                {
+                    return param.value;
+                }
+            }
+            return std::string_view();
+        }
+};
+
+// A handler is a plain function so route tables can be built at compile time.
+// It is called after the request body has been read and must send the response.
+using RouteHandler = void (*)(HTTPServer& server, RouteParams const& params, std::string const& body);
+
+// A path is a list of segments separated by '/'.
+// A segment ":name" matches any (non empty) segment and its value is passed
+// to the handler in RouteParams. A static segment is preferred over a parameter:
+//      "/users/new" is matched before "/users/:id"
+struct Route
+{
+    RequestType     method  = Get;
+    std::string_view path;
+    RouteHandler    handler = nullptr;
+
+    // FNV-1a of the path mixed with the method.
+    static constexpr std::size_t hash(RequestType method, std::string_view path)
+    {
+        std::uint64_t   result = 14695981039346656037ULL ^ static_cast<std::uint64_t>(method);
+        for(char c: path)
+        {
+            result = (result ^ static_cast<unsigned char>(c)) * 1099511628211ULL;
+        }
+        return static_cast<std::size_t>(result ^ (result >> 32));
+    }
+    // A path is "/" followed by '/' separated segments (the last may be empty).
+    // A parameter ":name" is a whole segment with a non empty name.
+    static constexpr bool validPath(std::string_view path)
+    {
+        if (path.empty() || path[0] != '/')
+        {
+            return false;
+        }
+        std::size_t params = 0;
+        for(std::size_t loop = 1; loop < path.size(); ++loop)
+        {
+            if (path[loop] == ':')
+            {
+                if (path[loop - 1] != '/' || loop + 1 == path.size() || path[loop + 1] == '/')
+                {
+                    return false;
+                }
+                ++params;
+            }
+        }
+        return params <= RouteParams::maxParams;
+    }
+    static constexpr bool hasParam(std::string_view path)
+    {
+        return path.find(':') != std::string_view::npos;
+    }
+};
+
+/*
+ * A route table built at compile time:
+ *
+ *      static constexpr Route          routes[] = {{Get,  "/users/:id", getUser},
+ *                                                  {Post, "/users",     addUser}};
+ *      static constexpr RouteTable     table(routes);
+ *      Router                          router(table);
+ *
+ * The paths are checked by the compiler: an invalid path or a duplicate
+ * route is a compile error.
+ *
+ * The routes without a parameter are put in an open addressed hash table
+ * (method and path) so most requests are dispatched with one hash of the
+ * path and one compare. The others are found by the Router's trie.
+ */
+template<std::size_t N>
+class RouteTable
+{
+    static_assert(N != 0, "RouteTable: Needs at least one route");
+    public:
+        // A power of two at least twice the number of routes.
+        static constexpr std::size_t slotCount = []()
+        {
+            std::size_t count = 1;
+            while(count < N * 2)
+            {
+                count *= 2;
+            }
+            return count;
+        }();
+    private:
+        Route                   routes[N];
+        // The index + 1 of a route (0 is empty).
+        std::uint32_t           slots[slotCount];
+
+        friend class Router;
+    public:
+        constexpr RouteTable(Route const (&table)[N])
+            : routes{}
+            , slots{}
+        {
+            for(std::size_t loop = 0; loop < N; ++loop)
+            {
+                routes[loop] = table[loop];
+                if (routes[loop].handler == nullptr || !Route::validPath(routes[loop].path))
+                {
+                    throw std::logic_error("RouteTable: Invalid route");
+                }
+                for(std::size_t check = 0; check < loop; ++check)
+                {
+                    if (routes[check].method == routes[loop].method && routes[check].path == routes[loop].path)
+                    {
+                        throw std::logic_error("RouteTable: Duplicate route");
+                    }
+                }
+                if (Route::hasParam(routes[loop].path))
+                {
+                    continue;
+                }
+                std::size_t slot = Route::hash(routes[loop].method, routes[loop].path) & (slotCount - 1);
+                while(slots[slot] != 0)
+                {
+                    slot = (slot + 1) & (slotCount - 1);
+                }
+                slots[slot] = loop + 1;
+            }
+        }
+
+        constexpr std::size_t   size()  const   {return N;}
+        constexpr Route const*  begin() const   {return routes;}
+        constexpr Route const*  end()   const   {return routes + N;}
+};
+
+/*
+ * Dispatches a request (method and path) to its handler.
+ *
+ * The routes are held in a radix trie: each node holds a run of static
+ * characters shared by all the routes below it, its static children
+ * (distinguished by their first character) and at most one parameter child.
+ * Finding a route reads each character of the path once (plus backtracking
+ * to a parameter when a static branch fails) and allocates nothing.
+ *
+ * Routes are added when the Router is built; it is not changed while it is
+ * used so one Router can be shared by all the worker threads.
+ */
+class Router
+{
+    public:
+        static constexpr std::size_t methodCount = Delete + 1;
+
+        // Returns the method type (Response if it is not one we route).
+        static RequestType requestType(std::string_view method);
+
+    private:
+        struct Node
+        {
+            // Static text (or for a parameter node its name).
+            std::string             label;
+            std::vector<std::size_t> children;
+            std::size_t             param;
+            RouteHandler            handlers[methodCount];
+            Node(std::string_view label)
+                : label(label)
+                , param(0)
+                , handlers{}
+            {}
+        };
+        // nodes[0] is the root. Children are referred to by index (0 is none).
+        std::vector<Node>       nodes;
+        // The routes of a RouteTable without parameters (see RouteTable).
+        Route const*            staticRoutes;
+        std::uint32_t const*    staticSlots;
+        std::size_t             staticMask;
+
+        std::size_t addStatic(std::size_t node, std::string_view text);
+        std::size_t addParam(std::size_t node, std::string_view name);
+        Node const* findNode(std::size_t node, std::string_view path, RouteParams& params) const;
+        Route const* findStatic(RequestType method, std::string_view path) const;
+
+    public:
+        Router();
+        // Note: The table is not copied. It must outlive the router
+        //       (declare it static constexpr).
+        template<std::size_t N>
+        explicit Router(RouteTable<N> const& table)
+            : Router()
+        {
+            staticRoutes    = table.routes;
+            staticSlots     = table.slots;
+            staticMask      = RouteTable<N>::slotCount - 1;
+            // All the routes are in the trie so a method that does not match
+            // a static route can be reported as 405 (rather than 404).
+            for(Route const& route: table)
+            {
+                add(route.method, route.path, route.handler);
+            }
+        }
+
+        // Throws std::logic_error if the path is invalid or the route already exists.
+        void add(RequestType method, std::string_view path, RouteHandler handler);
+
+        // Find the handler for `method` and `path` (a query string is ignored).
+        // Returns nullptr if there is none; `allowed` is then the bit set
+        // (1 << RequestType) of the methods the path does have (0 for none).
+        RouteHandler find(RequestType method, std::string_view path, RouteParams& params, unsigned int& allowed) const;
+
+        // Route the request just read by `server` (recvMessage() has read `body`).
+        // If there is no route a "404 Not Found" or "405 Method Not Allowed"
+        // response is sent and false is returned.
+        bool dispatch(HTTPServer& server, std::string const& body) const;
+};
+
+    }
+}
+
+#endif
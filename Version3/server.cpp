@@ -14,10 +14,18 @@ int main()
         Sock::DataSocket  accept  = server.accept();
         Sock::HTTPServer  acceptHTTPServer(accept);
 
-        std::string message;
-        acceptHTTPServer.recvMessage(message);
-        std::cout << message << "\n";
+        // Serve every request on the connection (including pipelined requests)
+        // until the client closes it or asks for "Connection: close".
+        while(acceptHTTPServer.hasMessage())
+        {
+            std::string message;
+            acceptHTTPServer.recvMessage(message);
 
-        acceptHTTPServer.sendMessage("", "OK");
+            Sock::HTTPMessageView const& view = acceptHTTPServer.getMessageView();
+            std::cout << view.getMethod() << " " << view.getUrl() << " (" << view.getHeader("Host") << ")\n";
+            std::cout << message << "\n";
+
+            acceptHTTPServer.sendMessage("", "OK");
+        }
     }
 }
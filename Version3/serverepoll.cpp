@@ -0,0 +1,41 @@
+
+#include "Socket.h"
+#include "ProtocolHTTP.h"
+#include "EventLoop.h"
+#include "Trace.h"
+#include <csignal>
+#include <cstdlib>
+#include <iostream>
+
+namespace Sock = ThorsAnvil::Socket;
+
+int main()
+{
+    // THORS_TRACE=<sample rate> records a trace.
+    // It is written to trace.json on SIGUSR1 (or fetch /trace).
+    if (char const* trace = std::getenv("THORS_TRACE"))
+    {
+        Sock::Trace::enable(std::atoi(trace));
+        Sock::Trace::dumpOnSignal(SIGUSR1, "trace.json");
+    }
+
+    Sock::ServerSocket   server(8080);
+    Sock::EventLoop      loop;
+
+    loop.listen(server, [](Sock::DataSocket& accept)
+    {
+        Sock::HTTPServer  acceptHTTPServer(accept);
+
+        // Serve every request on the connection (including pipelined requests)
+        // until the client closes it or asks for "Connection: close".
+        while(acceptHTTPServer.hasMessage())
+        {
+            std::string message;
+            acceptHTTPServer.recvMessage(message);
+            std::cout << message << "\n";
+
+            acceptHTTPServer.sendMessage("", "OK");
+        }
+    });
+    loop.run();
+}
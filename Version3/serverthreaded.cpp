@@ -0,0 +1,116 @@
+
+#include "Socket.h"
+#include "ProtocolHTTP.h"
+#include "Router.h"
+#include "ResponseCache.h"
+#include "WorkerPool.h"
+#include "Trace.h"
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <csignal>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+
+namespace Sock = ThorsAnvil::Socket;
+
+void sendOK(Sock::HTTPServer& server, Sock::RouteParams const&, std::string const&)
+{
+    server.sendMessage("", "OK");
+}
+
+// The responses to "/hello/:name" are built once (a minute) and then sent from the cache.
+Sock::ResponseCache helloCache;
+
+void sendHello(Sock::HTTPServer& server, Sock::RouteParams const& params, std::string const&)
+{
+    Sock::HTTPMessageView const&    view    = server.getMessageView();
+    Sock::ResponseCache::EntryPtr   entry   = helloCache.get(view.getMethod(), view.getUrl(), [&params]()
+    {
+        return Sock::buildStringFromParts("Hello ", params["name"]);
+    });
+    server.sendCached(*entry);
+}
+
+// Send a file from the current directory ("/file/:name").
+// The name is a single path segment; hidden files (and "..") are not served.
+void sendFile(Sock::HTTPServer& server, Sock::RouteParams const& params, std::string const&)
+{
+    std::string     name(params["name"]);
+    int             fileId  = name[0] == '.' ? -1 : ::open(name.c_str(), O_RDONLY | O_CLOEXEC);
+    struct stat     info;
+    if (fileId == -1 || ::fstat(fileId, &info) != 0 || !S_ISREG(info.st_mode))
+    {
+        if (fileId != -1)
+        {
+            ::close(fileId);
+        }
+        server.sendError(404);
+        return;
+    }
+    try
+    {
+        server.sendFile("", fileId, 0, info.st_size);
+    }
+    catch(...)
+    {
+        ::close(fileId);
+        throw;
+    }
+    ::close(fileId);
+}
+
+// Checked (and the static routes hashed) at compile time.
+static constexpr Sock::Route        routes[]    = {{Sock::Get,  "/",            sendOK},
+                                                   {Sock::Post, "/message",     sendOK},
+                                                   {Sock::Get,  "/hello/:name", sendHello},
+                                                   {Sock::Get,  "/file/:name",  sendFile}};
+static constexpr Sock::RouteTable   routeTable(routes);
+
+int main(int argc, char* argv[])
+{
+    if (argc > 3 || (argc == 3 && std::strcmp(argv[2], "epoll") != 0 && std::strcmp(argv[2], "uring") != 0))
+    {
+        std::cerr << "Usage: serverthreaded [<workers> [epoll|uring]]\n";
+        std::exit(1);
+    }
+    // By default io_uring is used when the kernel supports it.
+    Sock::EventLoop::Backend backend = Sock::EventLoop::Backend::Best;
+    if (argc == 3)
+    {
+        backend = std::strcmp(argv[2], "epoll") == 0 ? Sock::EventLoop::Backend::Epoll : Sock::EventLoop::Backend::URing;
+    }
+
+    // THORS_TRACE=<sample rate> records a trace.
+    // It is written to trace.json on SIGUSR1 (or fetch /trace).
+    if (char const* trace = std::getenv("THORS_TRACE"))
+    {
+        Sock::Trace::enable(std::atoi(trace));
+        Sock::Trace::dumpOnSignal(SIGUSR1, "trace.json");
+    }
+
+    // Shared by the workers (it is not changed once built).
+    Sock::Router         router(routeTable);
+
+    Sock::WorkerPool     server(8080, [&router](Sock::DataSocket& accept)
+    {
+        Sock::HTTPServer  acceptHTTPServer(accept);
+
+        // Serve every request on the connection (including pipelined requests)
+        // until the client closes it or asks for "Connection: close".
+        while(acceptHTTPServer.hasMessage())
+        {
+            // Note: Messages are not printed. A shared std::cout
+            //       would serialize the workers.
+            std::string message;
+            acceptHTTPServer.recvMessage(message);
+
+            // Unknown urls get a 404 (or 405 for the wrong method).
+            router.dispatch(acceptHTTPServer, message);
+        }
+    }, argc >= 2 ? std::atoi(argv[1]) : 0, backend);
+
+    std::cout << "Workers: " << server.getWorkerCount() << "\n";
+    server.run();
+}
@@ -1,7 +1,13 @@
 
 #include "Utility.h"
 #include <curl/curl.h>
-#include <sstream>
+#include <map>
+#include <deque>
+#include <vector>
+#include <memory>
+#include <future>
+#include <functional>
+#include <stdexcept>
 #include <iostream>
 #include <cstdlib>
 
@@ -29,12 +35,15 @@ class CurlGlobal
 extern "C" size_t curlConnectorGetData(char *ptr, size_t size, size_t nmemb, void *userdata);
 
 enum RequestType {Get, Head, Put, Post, Delete};
-class CurlConnector
+
+// An easy handle plus the state of one request on it.
+// The handle is reused for each request so curl can keep the
+// connection (and DNS lookup) from the previous request.
+class CurlHandle
 {
-    CURL*       curl;
-    std::string host;
-    int         port;
-    std::string response;
+    CURL*               curl;
+    struct curl_slist*  headers;
+    std::string         response;
 
     friend size_t curlConnectorGetData(char *ptr, size_t size, size_t nmemb, void *userdata);
     std::size_t getData(char *ptr, size_t size)
@@ -52,22 +61,110 @@ class CurlConnector
         }
     }
 
-
     public:
-        CurlConnector(std::string const& host, int port)
+        CurlHandle()
             : curl(curl_easy_init( ))
-            , host(host)
-            , port(port)
+            , headers(nullptr)
         {
             if (curl == nullptr)
             {
-                throw std::runtime_error(buildErrorMessage("CurlConnector::", __func__, ": curl_easy_init: fail"));
+                throw std::runtime_error(buildErrorMessage("CurlHandle::", __func__, ": curl_easy_init: fail"));
+            }
+            // The options that are the same for every request are only set once.
+            headers = curl_slist_append(headers, "Content-Type: text/text");
+            if (headers == nullptr)
+            {
+                curl_easy_cleanup(curl);
+                throw std::runtime_error(buildErrorMessage("CurlHandle::", __func__, ": curl_slist_append: fail"));
+            }
+            curlSetOptionWrapper(CURLOPT_HTTPHEADER,        headers,                "CurlHandle::", __func__, ": curl_easy_setopt CURLOPT_HTTPHEADER:");
+            curlSetOptionWrapper(CURLOPT_ACCEPT_ENCODING,   "*/*",                  "CurlHandle::", __func__, ": curl_easy_setopt CURLOPT_ACCEPT_ENCODING:");
+            curlSetOptionWrapper(CURLOPT_USERAGENT,         "ThorsCurl-Client/0.1", "CurlHandle::", __func__, ": curl_easy_setopt CURLOPT_USERAGENT:");
+            curlSetOptionWrapper(CURLOPT_WRITEFUNCTION,     curlConnectorGetData,   "CurlHandle::", __func__, ": curl_easy_setopt CURLOPT_WRITEFUNCTION:");
+            curlSetOptionWrapper(CURLOPT_WRITEDATA,         this,                   "CurlHandle::", __func__, ": curl_easy_setopt CURLOPT_WRITEDATA:");
+            curlSetOptionWrapper(CURLOPT_PRIVATE,           this,                   "CurlHandle::", __func__, ": curl_easy_setopt CURLOPT_PRIVATE:");
+        }
+        // Not movable: curl holds a pointer to this object (CURLOPT_WRITEDATA).
+        CurlHandle(CurlHandle const&)               = delete;
+        CurlHandle& operator=(CurlHandle const&)    = delete;
+        ~CurlHandle()
+        {
+            curl_easy_cleanup(curl);
+            curl_slist_free_all(headers);
+        }
+
+        CURL*       get()           {return curl;}
+        std::string takeResponse()  {return std::move(response);}
+
+        // Set up the handle for the next request.
+        void prepare(RequestType type, std::string const& url, std::string const& message)
+        {
+            response.clear();
+
+            CURLcode res;
+            curlSetOptionWrapper(CURLOPT_URL,               url.c_str(),            "CurlHandle::", __func__, ": curl_easy_setopt CURLOPT_URL:");
+            curlSetOptionWrapper(CURLOPT_POSTFIELDSIZE,     message.size(),         "CurlHandle::", __func__, ": curl_easy_setopt CURLOPT_POSTFIELDSIZE:");
+            curlSetOptionWrapper(CURLOPT_COPYPOSTFIELDS,    message.data(),         "CurlHandle::", __func__, ": curl_easy_setopt CURLOPT_COPYPOSTFIELDS:");
+
+            // The handle may have been used for a different method last time.
+            // So every method sets both the base method and the custom request.
+            char const* custom  = nullptr;
+            switch(type)
+            {
+                case Get:       res = curl_easy_setopt(curl, CURLOPT_HTTPGET, 1L);                      break;
+                case Head:      res = curl_easy_setopt(curl, CURLOPT_HTTPGET, 1L); custom = "HEAD";     break;
+                // The body is sent from the post fields (CURLOPT_UPLOAD would read it from a callback).
+                case Put:       res = curl_easy_setopt(curl, CURLOPT_POST, 1L);    custom = "PUT";      break;
+                case Post:      res = curl_easy_setopt(curl, CURLOPT_POST, 1L);                         break;
+                case Delete:    res = curl_easy_setopt(curl, CURLOPT_HTTPGET, 1L); custom = "DELETE";   break;
+                default:
+                    throw std::domain_error(buildErrorMessage("CurlHandle::", __func__, ": invalid method: ", static_cast<int>(type)));
             }
+            if (res != CURLE_OK)
+            {
+                throw std::runtime_error(buildErrorMessage("CurlHandle::", __func__, ": curl_easy_setopt CURL_METHOD:", curl_easy_strerror(res)));
+            }
+            curlSetOptionWrapper(CURLOPT_CUSTOMREQUEST,     custom,                 "CurlHandle::", __func__, ": curl_easy_setopt CURLOPT_CUSTOMREQUEST:");
         }
+        void perform()
+        {
+            CURLcode res;
+            if ((res = curl_easy_perform(curl)) != CURLE_OK)
+            {
+                throw std::runtime_error(buildErrorMessage("CurlHandle::", __func__, ": curl_easy_perform:", curl_easy_strerror(res)));
+            }
+        }
+};
+
+size_t curlConnectorGetData(char *ptr, size_t size, size_t nmemb, void *userdata)
+{
+    CurlHandle*     self = reinterpret_cast<CurlHandle*>(userdata);
+    return self->getData(ptr, size * nmemb);
+}
+
+inline std::string curlBuildURL(std::string const& host, int port, std::string const& urlPath)
+{
+    return port == 80
+        ? buildStringFromParts("http://", host, urlPath)
+        : buildStringFromParts("http://", host, ':', port, urlPath);
+}
+
+class CurlConnector
+{
+    std::unique_ptr<CurlHandle> handle;
+    std::string                 host;
+    int                         port;
+    std::string                 response;
+
+    public:
+        CurlConnector(std::string const& host, int port)
+            : handle(new CurlHandle)
+            , host(host)
+            , port(port)
+        {}
         CurlConnector(CurlConnector&)               = delete;
         CurlConnector& operator=(CurlConnector&)    = delete;
         CurlConnector(CurlConnector&& rhs) noexcept
-            : curl(nullptr)
         {
             rhs.swap(*this);
         }
@@ -79,68 +176,24 @@ class CurlConnector
         void swap(CurlConnector& other) noexcept
         {
             using std::swap;
-            swap(curl, other.curl);
+            swap(handle, other.handle);
             swap(host, other.host);
             swap(port, other.port);
             swap(response, other.response);
         }
-        ~CurlConnector()
-        {
-            if (curl)
-            {
-                curl_easy_cleanup(curl);
-            }
-        }
+        virtual ~CurlConnector() {}
 
         virtual RequestType getRequestType() const = 0;
 
         void sendMessage(std::string const& urlPath, std::string const& message)
         {
-            if (curl == nullptr)
+            if (!handle)
             {
                 throw std::logic_error(buildErrorMessage("CurlConnector::", __func__, ": bad  object (this object was moved)"));
             }
-            std::stringstream url;
-            response.clear();
-            url << "http://" << host;
-            if (port != 80)
-            {
-                url << ":" << port;
-            }
-            url << urlPath;
-
-            CURLcode res;
-            auto sListDeleter = [](struct curl_slist* headers){curl_slist_free_all(headers);};
-            std::unique_ptr<struct curl_slist, decltype(sListDeleter)> headers(nullptr, sListDeleter);
-            headers = std::unique_ptr<struct curl_slist, decltype(sListDeleter)>(curl_slist_append(headers.get(), "Content-Type: text/text"), sListDeleter);
-
-            curlSetOptionWrapper(CURLOPT_HTTPHEADER,        headers.get(),          "CurlConnector::", __func__, ": curl_easy_setopt CURLOPT_HTTPHEADER:");
-            curlSetOptionWrapper(CURLOPT_ACCEPT_ENCODING,   "*/*",                  "CurlConnector::", __func__, ": curl_easy_setopt CURLOPT_ACCEPT_ENCODING:");
-            curlSetOptionWrapper(CURLOPT_USERAGENT,         "ThorsCurl-Client/0.1", "CurlConnector::", __func__, ": curl_easy_setopt CURLOPT_USERAGENT:");
-            curlSetOptionWrapper(CURLOPT_URL,               url.str().c_str(),      "CurlConnector::", __func__, ": curl_easy_setopt CURLOPT_URL:");
-            curlSetOptionWrapper(CURLOPT_POSTFIELDSIZE,     message.size(),         "CurlConnector::", __func__, ": curl_easy_setopt CURLOPT_POSTFIELDSIZE:");
-            curlSetOptionWrapper(CURLOPT_COPYPOSTFIELDS,    message.data(),         "CurlConnector::", __func__, ": curl_easy_setopt CURLOPT_COPYPOSTFIELDS:");
-            curlSetOptionWrapper(CURLOPT_WRITEFUNCTION,     curlConnectorGetData,   "CurlConnector::", __func__, ": curl_easy_setopt CURLOPT_WRITEFUNCTION:");
-            curlSetOptionWrapper(CURLOPT_WRITEDATA,         this,                   "CurlConnector::", __func__, ": curl_easy_setopt CURLOPT_WRITEDATA:");
-
-            switch(getRequestType())
-            {
-                case Get:       res = CURLE_OK; /* The default is GET. So do nothing.*/         break;
-                case Head:      res = curl_easy_setopt(curl, CURLOPT_CUSTOMREQUEST, "HEAD");    break;
-                case Put:       res = curl_easy_setopt(curl, CURLOPT_PUT, 1);                   break;
-                case Post:      res = curl_easy_setopt(curl, CURLOPT_POST, 1);                  break;
-                case Delete:    res = curl_easy_setopt(curl, CURLOPT_CUSTOMREQUEST, "DELETE");  break;
-                default:
-                    throw std::domain_error(buildErrorMessage("CurlConnector::", __func__, ": invalid method: ", static_cast<int>(getRequestType())));
-            }
-            if (res != CURLE_OK)
-            {
-                throw std::runtime_error(buildErrorMessage("CurlConnector::", __func__, ": curl_easy_setopt CURL_METHOD:", curl_easy_strerror(res)));
-            }
-            if ((res = curl_easy_perform(curl)) != CURLE_OK)
-            {
-                throw std::runtime_error(buildErrorMessage("CurlConnector::", __func__, ": curl_easy_perform:", curl_easy_strerror(res)));
-            }
+            handle->prepare(getRequestType(), curlBuildURL(host, port, urlPath), message);
+            handle->perform();
+            response = handle->takeResponse();
         }
         void recvMessage(std::string& message)
         {
@@ -156,11 +209,156 @@ class CurlPost: public CurlConnector
 
 };
 
-size_t curlConnectorGetData(char *ptr, size_t size, size_t nmemb, void *userdata)
+// Runs many requests at the same time using the curl multi interface.
+//
+// Requests are queued with add() then run() drives them all concurrently
+// from the calling thread. At most `maxHandles` requests are in flight:
+// each uses one of a fixed set of easy handles which are reused for the
+// next queued request as soon as they finish. The multi handle shares
+// its connection cache between the easy handles so connections to a
+// backend are also reused.
+//
+// So a fan out to several backends takes about as long as the slowest
+// call rather than the sum of all of them.
+class CurlMulti
 {
-    CurlConnector*  self = reinterpret_cast<CurlConnector*>(userdata);
-    return self->getData(ptr, size * nmemb);
-}
+    public:
+        // Called from run() as each request completes.
+        // `result` is CURLE_OK on success.
+        using Callback  = std::function<void(CURLcode result, std::string&& response)>;
+    private:
+        struct Request
+        {
+            RequestType     type;
+            std::string     url;
+            std::string     message;
+            Callback        callback;
+        };
+
+        CURLM*                                      multi;
+        std::vector<std::unique_ptr<CurlHandle>>    handles;
+        std::vector<CurlHandle*>                    freeHandles;
+        std::map<CurlHandle*, Callback>             active;
+        std::deque<Request>                         waiting;
+
+        void start()
+        {
+            while(!freeHandles.empty() && !waiting.empty())
+            {
+                CurlHandle* handle  = freeHandles.back();
+                Request&    request = waiting.front();
+                handle->prepare(request.type, request.url, request.message);
+
+                CURLMcode res;
+                if ((res = curl_multi_add_handle(multi, handle->get())) != CURLM_OK)
+                {
+                    throw std::runtime_error(buildErrorMessage("CurlMulti::", __func__, ": curl_multi_add_handle: ", curl_multi_strerror(res)));
+                }
+                active.emplace(handle, std::move(request.callback));
+                freeHandles.pop_back();
+                waiting.pop_front();
+            }
+        }
+        void complete(CURLMsg* msg)
+        {
+            char* privateData = nullptr;
+            curl_easy_getinfo(msg->easy_handle, CURLINFO_PRIVATE, &privateData);
+            CurlHandle* handle  = reinterpret_cast<CurlHandle*>(privateData);
+            CURLcode    result  = msg->data.result;
+
+            // Note: msg is invalid after the handle is removed.
+            curl_multi_remove_handle(multi, handle->get());
+            auto        find    = active.find(handle);
+            Callback    callback = std::move(find->second);
+            active.erase(find);
+            freeHandles.push_back(handle);
+
+            callback(result, handle->takeResponse());
+        }
+    public:
+        static constexpr std::size_t defaultMaxHandles = 16;
+
+        CurlMulti(std::size_t maxHandles = defaultMaxHandles)
+            : multi(curl_multi_init())
+        {
+            if (multi == nullptr)
+            {
+                throw std::runtime_error(buildErrorMessage("CurlMulti::", __func__, ": curl_multi_init: fail"));
+            }
+            for(std::size_t loop = 0; loop < maxHandles; ++loop)
+            {
+                handles.emplace_back(new CurlHandle);
+                freeHandles.push_back(handles.back().get());
+            }
+        }
+        CurlMulti(CurlMulti const&)             = delete;
+        CurlMulti& operator=(CurlMulti const&)  = delete;
+        ~CurlMulti()
+        {
+            for(auto& request: active)
+            {
+                curl_multi_remove_handle(multi, request.first->get());
+            }
+            // The easy handles must be removed before the multi handle is cleaned up.
+            curl_multi_cleanup(multi);
+        }
+
+        // Queue a request. `callback` is called by run() when it completes.
+        void add(RequestType type, std::string const& host, int port, std::string const& urlPath, std::string const& message, Callback&& callback)
+        {
+            waiting.emplace_back(Request{type, curlBuildURL(host, port, urlPath), message, std::move(callback)});
+        }
+        // Queue a request. The future is ready when run() has completed the request.
+        std::future<std::string> add(RequestType type, std::string const& host, int port, std::string const& urlPath, std::string const& message)
+        {
+            auto                        promise = std::make_shared<std::promise<std::string>>();
+            std::future<std::string>    result  = promise->get_future();
+            add(type, host, port, urlPath, message, [promise](CURLcode result, std::string&& response)
+            {
+                if (result != CURLE_OK)
+                {
+                    promise->set_exception(std::make_exception_ptr(std::runtime_error(buildErrorMessage("CurlMulti::", "run", ": ", curl_easy_strerror(result)))));
+                    return;
+                }
+                promise->set_value(std::move(response));
+            });
+            return result;
+        }
+
+        // Drive all the queued requests until they have all completed.
+        void run()
+        {
+            start();
+            while(!active.empty())
+            {
+                int         running;
+                CURLMcode   res;
+                if ((res = curl_multi_perform(multi, &running)) != CURLM_OK)
+                {
+                    throw std::runtime_error(buildErrorMessage("CurlMulti::", __func__, ": curl_multi_perform: ", curl_multi_strerror(res)));
+                }
+
+                CURLMsg*    msg;
+                int         left;
+                while((msg = curl_multi_info_read(multi, &left)) != nullptr)
+                {
+                    if (msg->msg == CURLMSG_DONE)
+                    {
+                        complete(msg);
+                    }
+                }
+                // Put the freed handles to work before waiting.
+                start();
+                if (running != 0)
+                {
+                    if ((res = curl_multi_poll(multi, nullptr, 0, 1000, nullptr)) != CURLM_OK)
+                    {
+                        throw std::runtime_error(buildErrorMessage("CurlMulti::", __func__, ": curl_multi_poll: ", curl_multi_strerror(res)));
+                    }
+                }
+            }
+        }
+};
 
     }
 }
@@ -168,19 +366,36 @@ size_t curlConnectorGetData(char *ptr, size_t size, size_t nmemb, void *userdata
 int main(int argc, char* argv[])
 {
     namespace Sock = ThorsAnvil::Socket;
-    if (argc != 3)
+    if (argc != 3 && argc != 4)
     {
-        std::cerr << "Usage: client <host> <Message>\n";
+        std::cerr << "Usage: client <host> <Message> [<count>]\n";
         std::exit(1);
     }
 
     Sock::CurlGlobal    curlInit;
-    Sock::CurlPost      connect(argv[1], 8080);
+    if (argc == 3)
+    {
+        Sock::CurlPost      connect(argv[1], 8080);
 
-    connect.sendMessage("/message", argv[2]);
+        connect.sendMessage("/message", argv[2]);
 
-    std::string message;
-    connect.recvMessage(message);
-    std::cout << message << "\n";
-}
+        std::string message;
+        connect.recvMessage(message);
+        std::cout << message << "\n";
+        return 0;
+    }
 
+    // Send <count> copies of the message concurrently.
+    int                                     count   = std::atoi(argv[3]);
+    Sock::CurlMulti                         batch;
+    std::vector<std::future<std::string>>   results;
+    for(int loop = 0; loop < count; ++loop)
+    {
+        results.emplace_back(batch.add(Sock::Post, argv[1], 8080, "/message", argv[2]));
+    }
+    batch.run();
+    for(auto& result: results)
+    {
+        std::cout << result.get() << "\n";
+    }
+}